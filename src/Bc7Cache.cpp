@@ -0,0 +1,190 @@
+#include "pch.h"
+#include "Bc7Cache.h"
+#include "Numa.h"
+
+#include <atomic>
+
+CORE_NAMESPACE_BEGIN
+
+// 12 MB, emptied per texture by a new epoch
+constexpr int kBlockCacheBits = 16;
+constexpr size_t kBlockCacheSize = size_t(1) << kBlockCacheBits;
+
+// Slots tried after the hashed one
+constexpr size_t kBlockCacheProbes = 4;
+
+// State holds the epoch above the kind, an entry of an older epoch is empty
+enum : uint32_t { kEntryWriting = 1, kEntryReady = 2 };
+
+constexpr int kEpochShift = 2;
+
+struct alignas(64) BlockCacheEntry
+{
+	std::atomic<uint32_t> State;
+
+	int ErrorAlpha, ErrorTotal;
+
+	double QualityAlpha, QualityColor;
+
+	uint8_t Output[16];
+
+	__m128i Key[9];
+};
+
+static BlockCacheEntry* gBlockCache = nullptr;
+
+// Zeroed pages are of epoch 0
+static uint32_t gBlockCacheEpoch = 1;
+
+static std::atomic<int64_t> gBlockCacheHits;
+static std::atomic<int64_t> gBlockCacheMisses;
+
+void InitBlockCache(bool enabled)
+{
+	if (gBlockCache)
+	{
+		NumaFree(gBlockCache, kBlockCacheSize * sizeof(BlockCacheEntry));
+
+		gBlockCache = nullptr;
+	}
+
+	if (enabled)
+	{
+		// Zeroed pages are empty entries
+		gBlockCache = static_cast<BlockCacheEntry*>(NumaAllocate(kBlockCacheSize * sizeof(BlockCacheEntry), -1));
+	}
+
+	gBlockCacheEpoch = 1;
+
+	gBlockCacheHits = 0;
+	gBlockCacheMisses = 0;
+}
+
+void ResetBlockCache() noexcept
+{
+	if (!gBlockCache)
+		return;
+
+	if (++gBlockCacheEpoch >= (1u << (32 - kEpochShift)))
+	{
+		memset(static_cast<void*>(gBlockCache), 0, kBlockCacheSize * sizeof(BlockCacheEntry));
+
+		gBlockCacheEpoch = 1;
+	}
+}
+
+bool BlockCacheEnabled() noexcept
+{
+	return gBlockCache != nullptr;
+}
+
+void MakeBlockCacheKey(BlockCacheKey& key, const Cell& input, const uint8_t output[16]) noexcept
+{
+	for (size_t i = 0; i < 4; i++)
+	{
+		key.Data[i] = input.ImageRows_U8[i];
+		key.Data[i + 4] = input.MaskRows_S8[i];
+	}
+
+	key.Data[8] = _mm_loadu_si128((const __m128i*)output);
+
+	uint64_t hash = 0;
+
+	for (size_t i = 0; i < 9; i++)
+	{
+		hash = (hash ^ static_cast<uint64_t>(_mm_cvtsi128_si64(key.Data[i]))) * 0x9E3779B97F4A7C15uLL;
+		hash = (hash ^ static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(key.Data[i], key.Data[i])))) * 0x9E3779B97F4A7C15uLL;
+	}
+
+	key.Hash = hash ^ (hash >> 29);
+}
+
+static INLINED bool IsSameKey(const __m128i a[9], const __m128i b[9]) noexcept
+{
+	__m128i mdiff = _mm_setzero_si128();
+
+	for (size_t i = 0; i < 9; i++)
+	{
+		mdiff = _mm_or_si128(mdiff, _mm_xor_si128(a[i], b[i]));
+	}
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(mdiff, _mm_setzero_si128())) == 0xFFFF;
+}
+
+static INLINED size_t GetSlot(const BlockCacheKey& key, size_t probe) noexcept
+{
+	return (static_cast<size_t>(key.Hash >> (64 - kBlockCacheBits)) + probe) & (kBlockCacheSize - 1);
+}
+
+bool FindBlock(const BlockCacheKey& key, uint8_t output[16], BlockError& error, BlockSSIM& quality) noexcept
+{
+	const uint32_t epoch = gBlockCacheEpoch << kEpochShift;
+
+	for (size_t probe = 0; probe < kBlockCacheProbes; probe++)
+	{
+		const BlockCacheEntry& entry = gBlockCache[GetSlot(key, probe)];
+
+		uint32_t state = entry.State.load(std::memory_order_acquire);
+		if ((state >> kEpochShift) != gBlockCacheEpoch)
+			break;
+
+		if ((state == (epoch | kEntryReady)) && IsSameKey(entry.Key, key.Data))
+		{
+			memcpy(output, entry.Output, 16);
+
+			error = BlockError(entry.ErrorAlpha, entry.ErrorTotal);
+			quality = BlockSSIM(entry.QualityAlpha, entry.QualityColor);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void StoreBlock(const BlockCacheKey& key, const uint8_t output[16], const BlockError& error, const BlockSSIM& quality) noexcept
+{
+	const uint32_t epoch = gBlockCacheEpoch << kEpochShift;
+
+	for (size_t probe = 0; probe < kBlockCacheProbes; probe++)
+	{
+		BlockCacheEntry& entry = gBlockCache[GetSlot(key, probe)];
+
+		uint32_t state = entry.State.load(std::memory_order_relaxed);
+		if (((state >> kEpochShift) != gBlockCacheEpoch) && entry.State.compare_exchange_strong(state, epoch | kEntryWriting, std::memory_order_acquire))
+		{
+			for (size_t i = 0; i < 9; i++)
+			{
+				entry.Key[i] = key.Data[i];
+			}
+
+			memcpy(entry.Output, output, 16);
+
+			entry.ErrorAlpha = error.Alpha;
+			entry.ErrorTotal = error.Total;
+
+			entry.QualityAlpha = quality.Alpha;
+			entry.QualityColor = quality.Color;
+
+			entry.State.store(epoch | kEntryReady, std::memory_order_release);
+			return;
+		}
+
+		if ((state == (epoch | kEntryReady)) && IsSameKey(entry.Key, key.Data))
+			return;
+	}
+}
+
+void AddBlockCacheCounters(int64_t hits, int64_t misses) noexcept
+{
+	gBlockCacheHits += hits;
+	gBlockCacheMisses += misses;
+}
+
+void TakeBlockCacheCounters(int64_t& hits, int64_t& misses) noexcept
+{
+	hits = gBlockCacheHits.exchange(0);
+	misses = gBlockCacheMisses.exchange(0);
+}
+
+CORE_NAMESPACE_END
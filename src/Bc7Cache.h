@@ -0,0 +1,35 @@
+#pragma once
+
+#include "pch.h"
+#include "Bc7Core.h"
+
+CORE_NAMESPACE_BEGIN
+
+// Byte-identical blocks with the same incoming output compress to the same result, shared between threads
+struct BlockCacheKey
+{
+	__m128i Data[9];
+
+	uint64_t Hash;
+};
+
+void InitBlockCache(bool enabled);
+
+bool BlockCacheEnabled() noexcept;
+
+// Empties the cache for the next texture
+void ResetBlockCache() noexcept;
+
+void MakeBlockCacheKey(BlockCacheKey& key, const Cell& input, const uint8_t output[16]) noexcept;
+
+bool FindBlock(const BlockCacheKey& key, uint8_t output[16], BlockError& error, BlockSSIM& quality) noexcept;
+
+// The first writer of a key wins, later ones and a full neighbourhood are ignored
+void StoreBlock(const BlockCacheKey& key, const uint8_t output[16], const BlockError& error, const BlockSSIM& quality) noexcept;
+
+void AddBlockCacheCounters(int64_t hits, int64_t misses) noexcept;
+
+// Returns and resets the counts since the previous call
+void TakeBlockCacheCounters(int64_t& hits, int64_t& misses) noexcept;
+
+CORE_NAMESPACE_END
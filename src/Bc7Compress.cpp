@@ -3,11 +3,11 @@
 
 #include "pch.h"
 #include "Bc7Core.h"
-#include "Bc7Tables.h"
-#include "Bc7Pca.h"
 #include "IO.h"
 #include "Worker.h"
 
+#include <stdlib.h>
+
 #include <chrono>
 #include <string>
 #include <vector>
@@ -89,7 +89,14 @@ static void PackTexture(const IBc7Core& bc7Core, uint8_t* dst_bc7, uint8_t* src_
 {
 	auto start = std::chrono::high_resolution_clock::now();
 
-	ProcessTexture(dst_bc7, src_bgra, mask_agrb, stride, src_w, src_h, blockKernel, block_size, pErrorAlpha, pErrorColor, pssim);
+	PBlockCost blockCost = (blockKernel == bc7Core.pCompress) ? bc7Core.pEstimate : nullptr;
+
+	if (blockKernel == bc7Core.pCompress)
+	{
+		bc7Core.pCacheReset();
+	}
+
+	ProcessTexture(dst_bc7, src_bgra, mask_agrb, stride, src_w, src_h, blockKernel, blockCost, block_size, pErrorAlpha, pErrorColor, pssim);
 
 	auto finish = std::chrono::high_resolution_clock::now();
 
@@ -103,6 +110,14 @@ static void PackTexture(const IBc7Core& bc7Core, uint8_t* dst_bc7, uint8_t* src_
 
 		PRINTF("    Compressed %d blocks, elapsed %i ms, throughput %d.%03d Mpx/s", pixels >> 4, span, kpx_s / 1000, kpx_s % 1000);
 
+		int64_t hits, misses;
+		bc7Core.pCacheCounters(hits, misses);
+
+		if (hits + misses > 0)
+		{
+			PRINTF("    Block cache %lld hits, %lld misses", static_cast<long long>(hits), static_cast<long long>(misses));
+		}
+
 #if defined(OPTION_COUNTERS)
 		CompressStatistics();
 #endif
@@ -233,9 +248,7 @@ static INLINED void VisualizePartitionsGRB(uint8_t* dst_bc7, int size)
 
 int Bc7MainWithArgs(const IBc7Core& bc7Core, const std::vector<std::string>& args)
 {
-	bool doDraft = true;
-	bool doNormal = true;
-	bool doSlow = false;
+	int effort = kEffortNormal;
 
 	bool flip = true;
 	bool mask = true;
@@ -255,30 +268,38 @@ int Bc7MainWithArgs(const IBc7Core& bc7Core, const std::vector<std::string>& arg
 		{
 			if (strcmp(arg, "/compare") == 0)
 			{
-				doDraft = false;
-				doNormal = false;
-				doSlow = false;
+				effort = kEffortCompare;
 				continue;
 			}
 			else if (strcmp(arg, "/draft") == 0)
 			{
-				doDraft = true;
-				doNormal = false;
-				doSlow = false;
+				effort = kEffortDraft;
 				continue;
 			}
 			else if (strcmp(arg, "/normal") == 0)
 			{
-				doDraft = true;
-				doNormal = true;
-				doSlow = false;
+				effort = kEffortNormal;
 				continue;
 			}
 			else if (strcmp(arg, "/slow") == 0)
 			{
-				doDraft = true;
-				doNormal = true;
-				doSlow = true;
+				effort = kEffortSlow;
+				continue;
+			}
+			else if (strcmp(arg, "/effort") == 0)
+			{
+				const char* value = (++i < n) ? args[i].c_str() : "";
+
+				char* end;
+				long level = strtol(value, &end, 10);
+
+				if ((end == value) || *end || (level < kEffortDraft) || (level > kEffortSlow))
+				{
+					PRINTF("Error: /effort %s, expected %d..%d", value, kEffortDraft, kEffortSlow);
+					return 1;
+				}
+
+				effort = static_cast<int>(level);
 				continue;
 			}
 			else if (strcmp(arg, "/noflip") == 0)
@@ -426,7 +447,7 @@ int Bc7MainWithArgs(const IBc7Core& bc7Core, const std::vector<std::string>& arg
 	head[22] = flip ? 0x00753Du : 0x00643Du;
 	head[23] = static_cast<uint32_t>(Size); // imageSize
 
-	bc7Core.pInitTables(doDraft, doNormal, doSlow);
+	bc7Core.pInitTables(effort);
 
 	memcpy(dst_texture_bgra, src_texture_bgra, src_texture_h * src_texture_stride);
 
@@ -492,7 +513,7 @@ int Bc7MainWithArgs(const IBc7Core& bc7Core, const std::vector<std::string>& arg
 
 		if ((bad_name != nullptr) && bad_name[0])
 		{
-			ShowBadBlocks(src_texture_bgra, dst_texture_bgra, mask_agrb, src_texture_stride, src_texture_w, src_texture_h);
+			bc7Core.pShowBadBlocks(src_texture_bgra, dst_texture_bgra, mask_agrb, src_texture_stride, src_texture_w, src_texture_h);
 
 			WriteImage(bad_name, mask_agrb, src_texture_w, src_texture_h, flip);
 		}
@@ -536,7 +557,7 @@ int __cdecl main(int argc, char* argv[])
 
 	if (argc < 2)
 	{
-		PRINTF("Usage: Bc7Compress [/draft | /normal | /slow] [/retina] [/nomask] [/noflip] src");
+		PRINTF("Usage: Bc7Compress [/draft | /normal | /slow | /effort 0..10] [/retina] [/nomask] [/noflip] src");
 		PRINTF("                   [dst.ktx] [/debug result.png] [/map partitions.png] [/bad bad.png]");
 		return 1;
 	}
@@ -1,17 +1,27 @@
 
 #include "pch.h"
 #include "Bc7Core.h"
+#include "Bc7Cache.h"
 #include "Bc7Tables.h"
 #include "Bc7Pca.h"
+#include "Bc7Rank.h"
 #include "Metrics.h"
 #include "Worker.h"
 
+#if !defined(OPTION_LIBRARY)
+#include <stdio.h>
+#endif
+
+#include <memory>
+
 #if defined(OPTION_COUNTERS)
 #include "SnippetLevelsMinimum.h"
 #include "SnippetLevelsBuffer.h"
 #include "SnippetLevelsBufferHalf.h"
 #endif
 
+CORE_NAMESPACE_BEGIN
+
 #if defined(OPTION_COUNTERS)
 static std::atomic_int gCounterModes[8];
 static std::atomic_int gCompressAlready, gCompress, gCompressBad;
@@ -19,7 +29,48 @@ static std::atomic_int gCompressAlready, gCompress, gCompressBad;
 
 static bool gDoDraft = false;
 static bool gDoNormal = false;
-static bool gDoSlow = false;
+
+// Search depth past the draft chains, kEffortNormal and kEffortSlow are /normal and /slow
+struct EffortLevel
+{
+	// Modes whose draft winners CompressBestMode refines, mode 6 takes the most time
+	uint8_t Winners;
+
+	// Links of the full chains run for opaque and for other blocks
+	uint8_t FullOpaque, Full;
+
+	// Best ranked partitions of modes 0, 1, 2, 3 and 7, see RankPartitions2, only the full chains rank them
+	uint8_t Partitions;
+
+	// Best ranked rotations of modes 4 and 5, see RankRotations
+	uint8_t Rotations;
+
+	// The routes that only refine the draft winner are taken
+	bool Refine;
+
+	// Gray blocks search G, R and B as one channel, see Area::IsGray
+	bool Gray;
+};
+
+static const EffortLevel gEffortLevels[kEffortSlow + 1] =
+{
+	{ 0x00, 0, 0, 2, 2, true, true },
+	{ 0xBF, 0, 0, 2, 2, true, true },
+	{ 0xBF, 2, 2, 2, 2, true, true },
+	{ 0xFF, 0, 0, 2, 2, true, true },
+	{ 0xFF, 2, 2, 2, 2, true, true },
+	{ 0xFF, 3, 3, 8, 3, true, true },
+	{ 0xFF, 4, 3, 8, 3, true, true },
+	{ 0xFF, 8, 4, 8, 3, true, true },
+	{ 0xFF, 8, 4, 16, 4, true, true },
+	{ 0xFF, 8, 4, 32, 8, false, true },
+	{ 0xFF, 8, 4, 64, 8, false, false }
+};
+
+static EffortLevel gEffort = gEffortLevels[kEffortNormal];
+
+// Mode-major order over groups of blocks, see CompressKernelPhased
+static bool gDoPhased = false;
 
 static INLINED int ComputeOpaqueAlphaError(const Area& area) noexcept
 {
@@ -42,6 +93,8 @@ static INLINED int ComputeOpaqueAlphaError(const Area& area) noexcept
 	return error;
 }
 
+static thread_local AreaPool gAreaPool;
+
 static INLINED void MakeCell(Cell& input, const Cell& decoded) noexcept
 {
 	input.BestColor0 = decoded.BestColor0;
@@ -78,27 +131,26 @@ static INLINED void MakeCell(Cell& input, const Cell& decoded) noexcept
 
 	input.IsOpaque = ((_mm_extract_epi16(m0, 0) & _mm_extract_epi16(m0, 4)) == 255);
 
-	for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
-	{
-		input.LazyArea12[partitionIndex] = true;
-	}
-	for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
-	{
-		input.LazyArea22[partitionIndex] = true;
-	}
+	// A new generation drops the Areas of the previous block in the pool
+	AreaPool& pool = gAreaPool;
 
-	for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
-	{
-		input.LazyArea13[partitionIndex] = true;
-	}
-	for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
-	{
-		input.LazyArea23[partitionIndex] = true;
-	}
-	for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
+	if (++pool.Generation == 0)
 	{
-		input.LazyArea33[partitionIndex] = true;
+		memset(pool.Generations, 0, sizeof(pool.Generations));
+
+		pool.Generation = 1;
 	}
+
+	input.Pool = &pool;
+	input.Generation = pool.Generation;
+}
+
+// G, R and B equal in every pixel and oriented alike, so one channel search serves all three
+static ALWAYS_INLINED bool IsGrayArea(const __m128i mgray, const __m128i mbounds) noexcept
+{
+	const __m128i mgreen = _mm_shuffle_epi32(mbounds, _MM_SHUFFLE(1, 1, 1, 0));
+
+	return (_mm_cvtsi128_si64(mgray) == 0) && (_mm_movemask_epi8(_mm_cmpeq_epi16(mbounds, mgreen)) == 0xFFFF);
 }
 
 NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t count, uint64_t indices) noexcept
@@ -113,6 +165,7 @@ NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t coun
 
 	__m128i m0 = _mm_set1_epi16(255);
 	__m128i m1 = _mm_setzero_si128();
+	__m128i mgray = _mm_setzero_si128();
 
 	const size_t flags = (uint32_t)cell.VisibleFlags;
 	if (flags == 0xFFFF)
@@ -144,6 +197,7 @@ NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t coun
 
 				m0 = _mm_min_epi16(m0, mpacked);
 				m1 = _mm_max_epi16(m1, mpacked);
+				mgray = _mm_or_si128(mgray, _mm_xor_si128(mpacked, _mm_shufflelo_epi16(mpacked, _MM_SHUFFLE(1, 1, 1, 0))));
 
 				__m128i mpixel = _mm_cvtepu16_epi32(mpacked);
 
@@ -228,6 +282,8 @@ NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t coun
 
 			_mm_store_si128(&area.Bounds_U16, mbounds);
 
+			area.IsGray = gEffort.Gray && IsGrayArea(mgray, mbounds);
+
 			return;
 		}
 	}
@@ -286,6 +342,7 @@ NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t coun
 
 		m0 = _mm_min_epi16(m0, mpacked);
 		m1 = _mm_max_epi16(m1, mpacked);
+		mgray = _mm_or_si128(mgray, _mm_xor_si128(mpacked, _mm_shufflelo_epi16(mpacked, _MM_SHUFFLE(1, 1, 1, 0))));
 
 		__m128i mpixel = _mm_cvtepu16_epi32(mpacked);
 
@@ -482,6 +539,8 @@ NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t coun
 	}
 
 	_mm_store_si128(&area.Bounds_U16, mbounds);
+
+	area.IsGray = gEffort.Gray && IsGrayArea(mgray, mbounds);
 }
 
 int AreaGetBestPca3(Area& area) noexcept
@@ -1002,8 +1061,178 @@ static void DecompressBlock(uint8_t input[16], Cell& output) noexcept
 	}
 }
 
-static void CompressBlock(uint8_t output[16], Cell& input) noexcept
+// A link of a mode chain, it runs while the error stays above the denoise step, plus the opaque alpha error for modes without alpha
+struct ModeStep
+{
+	void (*Compress)(Cell& input) noexcept;
+	bool OpaqueAlpha;
+};
+
+static const ModeStep gDraftChain[] =
+{
+	{ Mode6::CompressBlockFast, false },
+	{ Mode4::CompressBlockFast, false },
+	{ Mode5::CompressBlockFast, false },
+	{ Mode7::CompressBlockFast, false }
+};
+
+static const ModeStep gDraftOpaqueChain[] =
+{
+	{ Mode3::CompressBlockFast, true },
+	{ Mode1::CompressBlockFast, true },
+	{ Mode2::CompressBlockFast, true },
+	{ Mode0::CompressBlockFast, true }
+};
+
+// Normal runs the first three links, slow all of them
+static const ModeStep gFullOpaqueChain[] =
+{
+	{ Mode2::CompressBlockFull, true },
+	{ Mode0::CompressBlockFull, true },
+	{ Mode1::CompressBlockFull, true },
+	{ Mode3::CompressBlockFull, true },
+	{ Mode5::CompressBlockFull, false },
+	{ Mode4::CompressBlockFull, false },
+	{ Mode7::CompressBlockFull, false },
+	{ Mode6::CompressBlockFull, false }
+};
+
+// Normal runs the first three links, slow all of them
+static const ModeStep gFullChain[] =
+{
+	{ Mode5::CompressBlockFull, false },
+	{ Mode4::CompressBlockFull, false },
+	{ Mode7::CompressBlockFull, false },
+	{ Mode6::CompressBlockFull, false }
+};
+
+// Mode 4 wins most blocks where transparent and opaque pixels meet
+static const ModeStep gFullAlphaEdgeChain[] =
+{
+	{ Mode4::CompressBlockFull, false },
+	{ Mode5::CompressBlockFull, false },
+	{ Mode7::CompressBlockFull, false },
+	{ Mode6::CompressBlockFull, false }
+};
+
+static INLINED size_t FullChainLength(bool opaque) noexcept
+{
+	return opaque ? gEffort.FullOpaque : gEffort.Full;
+}
+
+static INLINED bool NeedsModeStep(const Cell& input, const ModeStep& step) noexcept
+{
+	return input.Error.Total > input.DenoiseStep + (step.OpaqueAlpha ? input.OpaqueAlphaError : 0);
+}
+
+static INLINED void RunModeChain(Cell& input, const ModeStep* chain, size_t count) noexcept
+{
+	for (size_t i = 0; (i < count) && NeedsModeStep(input, chain[i]); i++)
+	{
+		chain[i].Compress(input);
+	}
+}
+
+// DetectGlitches
+static INLINED bool NeedsDraftOpaqueChain(const Cell& input) noexcept
+{
+	return *(const short*)&input.Area1.MinMax_U16 > (255 - 16);
+}
+
+static void CompressBestMode(Cell& input) noexcept
+{
+	// Left as drafted, so the full searches do not skip it
+	if (!((gEffort.Winners >> input.BestMode) & 1))
+	{
+		input.PersonalMode = 8;
+		return;
+	}
+
+	switch (input.BestMode)
+	{
+	case 0:
+		if (input.Error.Total > input.OpaqueAlphaError)
+		{
+			Mode0::CompressBlock(input);
+		}
+		break;
+
+	case 1:
+		if (input.Error.Total > input.OpaqueAlphaError)
+		{
+			Mode1::CompressBlock(input);
+		}
+		break;
+
+	case 2:
+		if (input.Error.Total > input.OpaqueAlphaError)
+		{
+			Mode2::CompressBlock(input);
+		}
+		break;
+
+	case 3:
+		if (input.Error.Total > input.OpaqueAlphaError)
+		{
+			Mode3::CompressBlock(input);
+		}
+		break;
+
+	case 4:
+		if (input.Error.Total > 0)
+		{
+			Mode4::CompressBlock(input);
+		}
+		break;
+
+	case 5:
+		if (input.Error.Total > 0)
+		{
+			Mode5::CompressBlock(input);
+		}
+		break;
+
+	case 6:
+		if (input.Error.Total > 0)
+		{
+			Mode6::CompressBlock(input);
+		}
+		break;
+
+	case 7:
+		if (input.Error.Total > 0)
+		{
+			Mode7::CompressBlock(input);
+		}
+		break;
+	}
+
+	input.PersonalParameter = input.BestParameter;
+	input.PersonalMode = input.BestMode;
+}
+
+// State of a block between BeginBlock and EndBlock
+struct BlockTask
+{
+	uint8_t* Output;
+
+	// Error of the incoming output, a search result replaces it only when lower
+	int Water;
+
+	bool Alive;
+
+	// Water left after CompressSolidBlock, the phased chains skip the block otherwise
+	bool Searching;
+
+#if defined(OPTION_SELFCHECK)
+	uint8_t Saved[16];
+#endif
+};
+
+static void BeginBlock(BlockTask& task, Cell& input) noexcept
 {
+	uint8_t* output = task.Output;
+
 	if (!output[0])
 	{
 		*(uint64_t*)&output[0] = 1 << 6;
@@ -1011,13 +1240,15 @@ static void CompressBlock(uint8_t output[16], Cell& input) noexcept
 	}
 
 #if defined(OPTION_SELFCHECK)
-	uint8_t saved_output[16];
-	memcpy(saved_output, output, sizeof(saved_output));
+	memcpy(task.Saved, output, sizeof(task.Saved));
 #endif
 
 	Cell temp;
 	DecompressBlock(output, temp);
 
+	input.PartitionsLimit = gEffort.Partitions;
+	input.RotationsLimit = gEffort.Rotations;
+
 	input.Error = CompareBlocks(input, temp);
 	if (input.Error.Total > 0)
 	{
@@ -1027,238 +1258,182 @@ static void CompressBlock(uint8_t output[16], Cell& input) noexcept
 
 		if (gDoDraft)
 		{
-			const int denoiseStep = static_cast<int>(input.Area1.Active) * ((input.Area1.IsOpaque ? kDenoiseStep * kColor : kDenoiseStep * (kColor + kAlpha)) >> (kDenoise + kDenoise));
-			input.DenoiseStep = denoiseStep;
+			input.DenoiseStep = static_cast<int>(input.Area1.Active) * ((input.Area1.IsOpaque ? kDenoiseStep * kColor : kDenoiseStep * (kColor + kAlpha)) >> (kDenoise + kDenoise));
 
 			input.OpaqueAlphaError = ComputeOpaqueAlphaError(input.Area1);
+		}
+	}
 
-			int water = input.Error.Total;
+	task.Water = input.Error.Total;
+}
 
-			if (input.Error.Total > denoiseStep)
-			{
-				Mode6::CompressBlockFast(input);
+// Every pixel visible and of one color
+static INLINED bool IsSolidBlock(const Cell& input) noexcept
+{
+	const Area& area = input.Area1;
+	if (area.Active != area.Count)
+		return false;
 
-				if (input.Error.Total > denoiseStep)
-				{
-					Mode4::CompressBlockFast(input);
+	const __m128i mbounds = area.MinMax_U16;
+	const __m128i mswapped = _mm_shufflehi_epi16(_mm_shufflelo_epi16(mbounds, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
 
-					if (input.Error.Total > denoiseStep)
-					{
-						Mode5::CompressBlockFast(input);
+	return _mm_movemask_epi8(_mm_cmpeq_epi16(mbounds, mswapped)) == 0xFFFF;
+}
 
-						if (input.Error.Total > denoiseStep)
-						{
-							Mode7::CompressBlockFast(input);
-						}
-					}
-				}
-			}
+// Mode 5 reproduces any single color exactly, the chains cannot do better
+static INLINED bool CompressSolidBlock(Cell& input) noexcept
+{
+	if (!IsSolidBlock(input))
+		return false;
 
-			// DetectGlitches
-			if (*(const short*)&input.Area1.MinMax_U16 > (255 - 16))
-			{
-				if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-				{
-					Mode3::CompressBlockFast(input);
-
-					if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-					{
-						Mode1::CompressBlockFast(input);
-
-						if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-						{
-							Mode2::CompressBlockFast(input);
-
-							if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-							{
-								Mode0::CompressBlockFast(input);
-							}
-						}
-					}
-				}
-			}
+	Mode5::CompressBlockSolid(input);
 
-#if defined(OPTION_COUNTERS)
-			gCompress++;
-#endif
+	return input.Error.Total <= 0;
+}
 
-			if (gDoNormal)
-			{
-				switch (input.BestMode)
-				{
-				case 0:
-					if (input.Error.Total > input.OpaqueAlphaError)
-					{
-						Mode0::CompressBlock(input);
-					}
-					break;
+enum BlockClass : uint8_t
+{
+	kClassTwoColor, kClassGradient, kClassDetail, kClassAlphaEdge,
 
-				case 1:
-					if (input.Error.Total > input.OpaqueAlphaError)
-					{
-						Mode1::CompressBlock(input);
-					}
-					break;
+	kBlockClasses
+};
 
-				case 2:
-					if (input.Error.Total > input.OpaqueAlphaError)
-					{
-						Mode2::CompressBlock(input);
-					}
-					break;
+// Visible pixels take at most two values
+static INLINED bool IsTwoColorArea(const Area& area) noexcept
+{
+	const uint64_t first = static_cast<uint64_t>(_mm_cvtsi128_si64(area.DataMask_I16[0]));
+	uint64_t second = first;
 
-				case 3:
-					if (input.Error.Total > input.OpaqueAlphaError)
-					{
-						Mode3::CompressBlock(input);
-					}
-					break;
+	for (size_t i = 1, n = area.Active; i < n; i++)
+	{
+		const uint64_t value = static_cast<uint64_t>(_mm_cvtsi128_si64(area.DataMask_I16[i]));
+		if ((value == first) || (value == second))
+			continue;
 
-				case 4:
-					if (input.Error.Total > 0)
-					{
-						Mode4::CompressBlock(input);
-					}
-					break;
+		if (second != first)
+			return false;
 
-				case 5:
-					if (input.Error.Total > 0)
-					{
-						Mode5::CompressBlock(input);
-					}
-					break;
+		second = value;
+	}
 
-				case 6:
-					if (input.Error.Total > 0)
-					{
-						Mode6::CompressBlock(input);
-					}
-					break;
+	return true;
+}
 
-				case 7:
-					if (input.Error.Total > 0)
-					{
-						Mode7::CompressBlock(input);
-					}
-					break;
-				}
+static INLINED BlockClass ClassifyBlock(const Cell& input) noexcept
+{
+	const Area& area = input.Area1;
 
-				input.PersonalParameter = input.BestParameter;
-				input.PersonalMode = input.BestMode;
+	const __m128i mbounds = area.MinMax_U16;
+	const __m128i mrange = _mm_sub_epi16(_mm_srli_epi32(mbounds, 16), _mm_and_si128(mbounds, _mm_set1_epi32(0xFFFF)));
 
-				if (input.Area1.IsOpaque)
-				{
-					if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-					{
-						Mode2::CompressBlockFull(input);
-
-						if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-						{
-							Mode0::CompressBlockFull(input);
-
-							if (gDoSlow)
-							{
-								if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-								{
-									Mode1::CompressBlockFull(input);
-
-									if (input.Error.Total > input.OpaqueAlphaError + denoiseStep)
-									{
-										Mode3::CompressBlockFull(input);
-
-										if (input.Error.Total > denoiseStep)
-										{
-											Mode5::CompressBlockFull(input);
-
-											if (input.Error.Total > denoiseStep)
-											{
-												Mode4::CompressBlockFull(input);
-
-												if (input.Error.Total > denoiseStep)
-												{
-													Mode7::CompressBlockFull(input);
-
-													if (input.Error.Total > denoiseStep)
-													{
-														Mode6::CompressBlockFull(input);
-													}
-												}
-											}
-										}
-									}
-								}
-							}
-						}
-					}
-				}
-				else
-				{
-					if (input.Error.Total > denoiseStep)
-					{
-						Mode5::CompressBlockFull(input);
-
-						if (input.Error.Total > denoiseStep)
-						{
-							Mode4::CompressBlockFull(input);
-
-							if (input.Error.Total > denoiseStep)
-							{
-								Mode7::CompressBlockFull(input);
-
-								if (gDoSlow)
-								{
-									if (input.Error.Total > denoiseStep)
-									{
-										Mode6::CompressBlockFull(input);
-									}
-								}
-							}
-						}
-					}
-				}
-			}
+	// Transparent and opaque pixels meet
+	if (_mm_extract_epi16(mrange, 0) > 0x80)
+		return kClassAlphaEdge;
 
-			if (water > input.Error.Total)
-			{
-				switch (input.BestMode)
-				{
-				case 0:
-					Mode0::FinalPackBlock(output, input);
-					break;
+	if (IsTwoColorArea(area))
+		return kClassTwoColor;
 
-				case 1:
-					Mode1::FinalPackBlock(output, input);
-					break;
+	const int range = _mm_extract_epi16(_mm_max_epi16(_mm_max_epi16(mrange, _mm_srli_si128(mrange, 4)), _mm_srli_si128(mrange, 8)), 2);
 
-				case 2:
-					Mode2::FinalPackBlock(output, input);
-					break;
+	return (range <= 0x20) ? kClassGradient : kClassDetail;
+}
 
-				case 3:
-					Mode3::FinalPackBlock(output, input);
-					break;
+// Chains per BlockClass, the easy classes go to the modes that win them.
+// Single-color blocks are done by CompressSolidBlock, and modes 4, 5 and 6 search gray blocks as one channel
+struct BlockRoute
+{
+	const ModeStep* FullOpaque;
+	const ModeStep* Full;
 
-				case 4:
-					Mode4::FinalPackBlock(output, input);
-					break;
+	// Normal refines the draft winner only, slow runs the chains anyway
+	bool Refine;
+};
 
-				case 5:
-					Mode5::FinalPackBlock(output, input);
-					break;
+static const BlockRoute gBlockRoutes[kBlockClasses] =
+{
+	{ gFullOpaqueChain, gFullChain, true },
+	{ gFullOpaqueChain, gFullChain, true },
+	{ gFullOpaqueChain, gFullChain, false },
+	{ gFullOpaqueChain, gFullAlphaEdgeChain, false }
+};
 
-				case 6:
-					Mode6::FinalPackBlock(output, input);
-					break;
+static INLINED size_t FullChainLength(const BlockRoute& route, bool opaque) noexcept
+{
+	return (route.Refine && gEffort.Refine) ? 0 : FullChainLength(opaque);
+}
 
-				case 7:
-					Mode7::FinalPackBlock(output, input);
-					break;
-				}
+static void SearchBlock(Cell& input) noexcept
+{
+	RunModeChain(input, gDraftChain, 4);
 
-				DecompressBlock(output, temp);
+	if (NeedsDraftOpaqueChain(input))
+	{
+		RunModeChain(input, gDraftOpaqueChain, 4);
+	}
+
+#if defined(OPTION_COUNTERS)
+	gCompress++;
+#endif
+
+	if (gDoNormal)
+	{
+		CompressBestMode(input);
+
+		const BlockRoute& route = gBlockRoutes[ClassifyBlock(input)];
+
+		const bool opaque = input.Area1.IsOpaque;
+
+		RunModeChain(input, opaque ? route.FullOpaque : route.Full, FullChainLength(route, opaque));
+	}
+}
+
+static void EndBlock(BlockTask& task, Cell& input) noexcept
+{
+	uint8_t* output = task.Output;
+
+	if (task.Water > 0)
+	{
+		if (gDoDraft && (task.Water > input.Error.Total))
+		{
+			switch (input.BestMode)
+			{
+			case 0:
+				Mode0::FinalPackBlock(output, input);
+				break;
+
+			case 1:
+				Mode1::FinalPackBlock(output, input);
+				break;
+
+			case 2:
+				Mode2::FinalPackBlock(output, input);
+				break;
+
+			case 3:
+				Mode3::FinalPackBlock(output, input);
+				break;
+
+			case 4:
+				Mode4::FinalPackBlock(output, input);
+				break;
+
+			case 5:
+				Mode5::FinalPackBlock(output, input);
+				break;
+
+			case 6:
+				Mode6::FinalPackBlock(output, input);
+				break;
+
+			case 7:
+				Mode7::FinalPackBlock(output, input);
+				break;
 			}
 		}
 
+		Cell temp;
+		DecompressBlock(output, temp);
+
 #if defined(OPTION_COUNTERS)
 		if (DetectGlitches(input, temp))
 		{
@@ -1267,12 +1442,11 @@ static void CompressBlock(uint8_t output[16], Cell& input) noexcept
 #endif
 
 #if defined(OPTION_SELFCHECK)
-		DecompressBlock(output, temp);
 		auto e = CompareBlocks(input, temp);
 		if ((e.Alpha != input.Error.Alpha) || (e.Total != input.Error.Total))
 		{
 			__debugbreak();
-			memcpy(output, saved_output, sizeof(saved_output));
+			memcpy(output, task.Saved, sizeof(task.Saved));
 		}
 #endif
 
@@ -1292,6 +1466,21 @@ static void CompressBlock(uint8_t output[16], Cell& input) noexcept
 #endif
 }
 
+static void CompressBlock(uint8_t output[16], Cell& input) noexcept
+{
+	BlockTask task;
+	task.Output = output;
+
+	BeginBlock(task, input);
+
+	if ((task.Water > 0) && gDoDraft && !CompressSolidBlock(input))
+	{
+		SearchBlock(input);
+	}
+
+	EndBlock(task, input);
+}
+
 #if defined(OPTION_COUNTERS)
 
 void CompressStatistics()
@@ -1343,29 +1532,63 @@ static ALWAYS_INLINED __m128i ConvertBgraToAgrb(__m128i mc) noexcept
 	return _mm_shuffle_epi8(mc, mrot);
 }
 
-static void InitTables(bool doDraft, bool doNormal, bool doSlow)
+static void InitTables(int effort)
 {
+	const bool doDraft = (effort >= kEffortDraft);
+	const bool doNormal = (effort > kEffortDraft);
+
 	gDoDraft = doDraft;
 	gDoNormal = doNormal;
-	gDoSlow = doSlow;
+
+	gEffort = gEffortLevels[doNormal ? ((effort < kEffortSlow) ? effort : kEffortSlow) : kEffortDraft];
+
+	{
+		const char* phased = getenv("NEBC7_PHASED");
+
+		gDoPhased = (phased != nullptr) && (strcmp(phased, "1") == 0);
+	}
+
+	{
+		const char* cache = getenv("NEBC7_CACHE");
+
+		InitBlockCache(doDraft && ((cache == nullptr) || (strcmp(cache, "0") != 0)));
+	}
 
 	{
 		static bool gsInited = false;
-		if (gsInited)
+		if (!gsInited)
 		{
-			return;
+			gsInited = true;
+
+			InitInterpolation();
+			InitShrinked();
+			InitSolid();
+			InitSelection();
+			InitRank();
+
+#if defined(OPTION_PCA)
+			InitPCA();
+#endif
 		}
-		gsInited = true;
 	}
 
-	InitInterpolation();
-	InitShrinked();
-	InitSelection();
-	InitLevels();
+	// CompressBlockFast reads level tables only for transparent pixels, with x = 0.
+	// CompressBlock and CompressBlockFull of every mode read all rows
+	if (doDraft)
+	{
+		const size_t size = LevelTablesSize();
+
+		InitLevels(doNormal);
 
-#if defined(OPTION_PCA)
-	InitPCA();
+		if (size != LevelTablesSize())
+		{
+			InitLevelReplicas();
+
+#if !defined(OPTION_LIBRARY)
+			PRINTF("  Tables %d KB in %s, %s", static_cast<int>(LevelTablesSize() >> 10), PageKindName(LevelTablesPages()), LevelTablesTiled() ? "tiles" : "rows");
 #endif
+		}
+	}
 }
 
 static void DecompressKernel(const WorkerItem* begin, const WorkerItem* end, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept
@@ -1400,55 +1623,463 @@ static void DecompressKernel(const WorkerItem* begin, const WorkerItem* end, int
 	}
 }
 
-static void CompressKernel(const WorkerItem* begin, const WorkerItem* end, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept
+static INLINED void LoadCell(Cell& input, const WorkerItem& item, int stride) noexcept
+{
+	{
+		const uint8_t* p = item._Cell;
+
+		input.ImageRows_U8[0] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+		p += stride;
+
+		input.ImageRows_U8[1] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+		p += stride;
+
+		input.ImageRows_U8[2] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+		p += stride;
+
+		input.ImageRows_U8[3] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+	}
+
+	{
+		const uint8_t* p = item._Mask;
+
+		input.MaskRows_S8[0] = _mm_loadu_si128((const __m128i*)p);
+
+		p += stride;
+
+		input.MaskRows_S8[1] = _mm_loadu_si128((const __m128i*)p);
+
+		p += stride;
+
+		input.MaskRows_S8[2] = _mm_loadu_si128((const __m128i*)p);
+
+		p += stride;
+
+		input.MaskRows_S8[3] = _mm_loadu_si128((const __m128i*)p);
+	}
+}
+
+static INLINED void AddBlockTotals(const Cell& input, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept
 {
+	pErrorAlpha += input.Error.Alpha << (kDenoise + kDenoise);
+	pErrorColor += (input.Error.Total - input.Error.Alpha) << (kDenoise + kDenoise);
+
+	pssim.Alpha += input.Quality.Alpha;
+	pssim.Color += input.Quality.Color;
+}
+
+static void CompressKernelSerial(const WorkerItem* begin, const WorkerItem* end, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept
+{
+	const bool cached = BlockCacheEnabled();
+
+	int64_t hits = 0, misses = 0;
+
 	Cell input;
+	BlockCacheKey key;
 
 	for (auto it = begin; it != end; it++)
 	{
+		LoadCell(input, *it, stride);
+
+		if (cached)
 		{
-			const uint8_t* p = it->_Cell;
+			MakeBlockCacheKey(key, input, it->_Output);
 
-			input.ImageRows_U8[0] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			if (FindBlock(key, it->_Output, input.Error, input.Quality))
+			{
+				hits++;
+			}
+			else
+			{
+				misses++;
 
-			p += stride;
+				CompressBlock(it->_Output, input);
+
+				StoreBlock(key, it->_Output, input.Error, input.Quality);
+			}
+		}
+		else
+		{
+			CompressBlock(it->_Output, input);
+		}
 
-			input.ImageRows_U8[1] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+		AddBlockTotals(input, pErrorAlpha, pErrorColor, pssim);
+	}
 
-			p += stride;
+	if (cached)
+	{
+		AddBlockCacheCounters(hits, misses);
+	}
+}
 
-			input.ImageRows_U8[2] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+// Blocks that step through the mode chains together, so one mode's tables stay hot
+constexpr size_t kPhaseBlocks = 16;
 
-			p += stride;
+static void RunModeChainPhased(Cell* cells, BlockTask* tasks, size_t count, const ModeStep* const* chains, size_t length) noexcept
+{
+	for (size_t k = 0; k < length; k++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!tasks[i].Alive)
+				continue;
+
+			const ModeStep& step = chains[i][k];
+
+			if (NeedsModeStep(cells[i], step))
+			{
+				step.Compress(cells[i]);
+			}
+			else
+			{
+				tasks[i].Alive = false;
+			}
+		}
+	}
+}
+
+// Same steps per block as SearchBlock
+static void SearchBlocksPhased(Cell* cells, BlockTask* tasks, size_t count) noexcept
+{
+	const BlockRoute* routes[kPhaseBlocks];
+	const ModeStep* chains[kPhaseBlocks];
+
+	for (size_t i = 0; i < count; i++)
+	{
+		tasks[i].Searching = (tasks[i].Water > 0) && !CompressSolidBlock(cells[i]);
 
-			input.ImageRows_U8[3] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+		tasks[i].Alive = tasks[i].Searching;
+
+		// Area1 is built for searched blocks only
+		routes[i] = tasks[i].Searching ? &gBlockRoutes[ClassifyBlock(cells[i])] : nullptr;
+
+		chains[i] = gDraftChain;
+	}
+
+	RunModeChainPhased(cells, tasks, count, chains, 4);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		tasks[i].Alive = tasks[i].Searching && NeedsDraftOpaqueChain(cells[i]);
+
+		chains[i] = gDraftOpaqueChain;
+	}
+
+	RunModeChainPhased(cells, tasks, count, chains, 4);
+
+#if defined(OPTION_COUNTERS)
+	for (size_t i = 0; i < count; i++)
+	{
+		if (tasks[i].Searching)
+		{
+			gCompress++;
+		}
+	}
+#endif
+
+	if (!gDoNormal)
+		return;
+
+	// The draft winners, CompressBestMode may change them
+	uint32_t modes[kPhaseBlocks];
+
+	for (size_t i = 0; i < count; i++)
+	{
+		modes[i] = tasks[i].Searching ? cells[i].BestMode : 8;
+	}
+
+	for (uint32_t mode = 0; mode < 8; mode++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (modes[i] == mode)
+			{
+				CompressBestMode(cells[i]);
+			}
+		}
+	}
+
+	for (int opaque = 1; opaque >= 0; opaque--)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			tasks[i].Alive = tasks[i].Searching && (cells[i].Area1.IsOpaque == (opaque != 0)) && (FullChainLength(*routes[i], opaque != 0) != 0);
+
+			chains[i] = tasks[i].Searching ? (opaque ? routes[i]->FullOpaque : routes[i]->Full) : nullptr;
 		}
 
+		RunModeChainPhased(cells, tasks, count, chains, FullChainLength(opaque != 0));
+	}
+}
+
+static void CompressKernelPhased(const WorkerItem* begin, const WorkerItem* end, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept
+{
+	// Too large for the stack, kept per thread
+	thread_local std::unique_ptr<Cell[]> tlsCells;
+	if (!tlsCells)
+	{
+		tlsCells.reset(new Cell[kPhaseBlocks]);
+	}
+
+	Cell* cells = tlsCells.get();
+
+	BlockTask tasks[kPhaseBlocks];
+
+	const bool cached = BlockCacheEnabled();
+
+	int64_t hits = 0, misses = 0;
+
+	BlockCacheKey keys[kPhaseBlocks];
+
+	for (auto it = begin; it != end;)
+	{
+		size_t count = 0;
+
+		// Cache hits are done here and leave the group
+		for (; (it != end) && (count < kPhaseBlocks); it++)
 		{
-			const uint8_t* p = it->_Mask;
+			Cell& input = cells[count];
 
-			input.MaskRows_S8[0] = _mm_loadu_si128((const __m128i*)p);
+			LoadCell(input, *it, stride);
 
-			p += stride;
+			if (cached)
+			{
+				MakeBlockCacheKey(keys[count], input, it->_Output);
 
-			input.MaskRows_S8[1] = _mm_loadu_si128((const __m128i*)p);
+				if (FindBlock(keys[count], it->_Output, input.Error, input.Quality))
+				{
+					hits++;
 
-			p += stride;
+					AddBlockTotals(input, pErrorAlpha, pErrorColor, pssim);
+					continue;
+				}
 
-			input.MaskRows_S8[2] = _mm_loadu_si128((const __m128i*)p);
+				misses++;
+			}
+
+			tasks[count].Output = it->_Output;
+
+			BeginBlock(tasks[count], input);
+
+			count++;
+		}
+
+		if (gDoDraft)
+		{
+			SearchBlocksPhased(cells, tasks, count);
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			Cell& input = cells[i];
+
+			EndBlock(tasks[i], input);
+
+			if (cached)
+			{
+				StoreBlock(keys[i], tasks[i].Output, input.Error, input.Quality);
+			}
+
+			AddBlockTotals(input, pErrorAlpha, pErrorColor, pssim);
+		}
+	}
+
+	if (cached)
+	{
+		AddBlockCacheCounters(hits, misses);
+	}
+}
+
+static void CompressKernel(const WorkerItem* begin, const WorkerItem* end, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept
+{
+	SelectLevelTables();
+
+	if (gDoPhased)
+	{
+		CompressKernelPhased(begin, end, stride, pErrorAlpha, pErrorColor, pssim);
+	}
+	else
+	{
+		CompressKernelSerial(begin, end, stride, pErrorAlpha, pErrorColor, pssim);
+	}
+}
+
+// Predicts relative CompressBlock work from the same bounds MakeAreaFromCell gets
+static void EstimateKernel(const WorkerItem* begin, const WorkerItem* end, int stride, uint32_t* costs) noexcept
+{
+	for (auto it = begin; it != end; it++)
+	{
+		__m128i m0 = _mm_set1_epi8(-1);
+		__m128i m1 = _mm_setzero_si128();
+
+		const uint8_t* p = it->_Cell;
+		const uint8_t* q = it->_Mask;
+
+		for (int y = 0; y < 4; y++)
+		{
+			__m128i mc = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			__m128i mmask = _mm_loadu_si128((const __m128i*)q);
+
+			m0 = _mm_min_epu8(m0, _mm_or_si128(mc, _mm_xor_si128(mmask, _mm_set1_epi8(-1))));
+			m1 = _mm_max_epu8(m1, _mm_and_si128(mc, mmask));
 
 			p += stride;
+			q += stride;
+		}
+
+		m0 = _mm_min_epu8(m0, _mm_shuffle_epi32(m0, _MM_SHUFFLE(1, 0, 3, 2)));
+		m1 = _mm_max_epu8(m1, _mm_shuffle_epi32(m1, _MM_SHUFFLE(1, 0, 3, 2)));
+		m0 = _mm_min_epu8(m0, _mm_shuffle_epi32(m0, _MM_SHUFFLE(2, 3, 0, 1)));
+		m1 = _mm_max_epu8(m1, _mm_shuffle_epi32(m1, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		__m128i mrange = _mm_subs_epu8(m1, m0);
+
+		mrange = _mm_max_epu8(mrange, _mm_srli_epi32(mrange, 16));
+		mrange = _mm_max_epu8(mrange, _mm_srli_epi32(mrange, 8));
 
-			input.MaskRows_S8[3] = _mm_loadu_si128((const __m128i*)p);
+		int range = _mm_cvtsi128_si32(mrange) & 0xFF;
+
+		uint32_t cost = 1;
+
+		if (range > 0)
+		{
+			cost = 16 + static_cast<uint32_t>(range >> 2);
+
+			// Full searches dominate otherwise
+			if (gDoNormal)
+			{
+				cost <<= 3;
+			}
+
+			bool opaque = ((_mm_cvtsi128_si32(m0) & 0xFF) == 255);
+			if (!opaque)
+			{
+				cost += cost;
+			}
 		}
 
-		CompressBlock(it->_Output, input);
+		costs[it - begin] = cost;
+	}
+}
 
-		pErrorAlpha += input.Error.Alpha << (kDenoise + kDenoise);
-		pErrorColor += (input.Error.Total - input.Error.Alpha) << (kDenoise + kDenoise);
+static void ShowBadBlocks(const uint8_t* src_bgra, const uint8_t* dst_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h) noexcept
+{
+	Cell input;
+	Cell output;
+
+	for (int y = 0; y < src_h; y += 4)
+	{
+		const uint8_t* src = src_bgra + y * stride;
+		const uint8_t* dst = dst_bgra + y * stride;
+		uint8_t* mask = mask_agrb + y * stride;
 
-		pssim.Alpha += input.Quality.Alpha;
-		pssim.Color += input.Quality.Color;
+		for (int x = 0; x < src_w; x += 4)
+		{
+			{
+				const uint8_t* p = src;
+
+				input.ImageRows_U8[0] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+				p += stride;
+
+				input.ImageRows_U8[1] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+				p += stride;
+
+				input.ImageRows_U8[2] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+				p += stride;
+
+				input.ImageRows_U8[3] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			}
+
+			{
+				const uint8_t* p = mask;
+
+				input.MaskRows_S8[0] = _mm_loadu_si128((const __m128i*)p);
+
+				p += stride;
+
+				input.MaskRows_S8[1] = _mm_loadu_si128((const __m128i*)p);
+
+				p += stride;
+
+				input.MaskRows_S8[2] = _mm_loadu_si128((const __m128i*)p);
+
+				p += stride;
+
+				input.MaskRows_S8[3] = _mm_loadu_si128((const __m128i*)p);
+			}
+
+			{
+				const uint8_t* p = dst;
+
+				output.ImageRows_U8[0] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+				p += stride;
+
+				output.ImageRows_U8[1] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+				p += stride;
+
+				output.ImageRows_U8[2] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+
+				p += stride;
+
+				output.ImageRows_U8[3] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			}
+
+			bool bad = DetectGlitches(input, output);
+			if (bad)
+			{
+				const uint8_t* r = src;
+				uint8_t* p = mask;
+
+				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+
+				r += stride;
+				p += stride;
+
+				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+
+				r += stride;
+				p += stride;
+
+				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+
+				r += stride;
+				p += stride;
+
+				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+			}
+			else
+			{
+				__m128i mc = _mm_setzero_si128();
+
+				uint8_t* p = mask;
+
+				_mm_storeu_si128((__m128i*)p, mc);
+
+				p += stride;
+
+				_mm_storeu_si128((__m128i*)p, mc);
+
+				p += stride;
+
+				_mm_storeu_si128((__m128i*)p, mc);
+
+				p += stride;
+
+				_mm_storeu_si128((__m128i*)p, mc);
+			}
+
+			src += 16;
+			dst += 16;
+			mask += 16;
+		}
 	}
 }
 
@@ -1461,5 +2092,14 @@ bool GetBc7Core(void* bc7Core)
 	p->pDecompress = &DecompressKernel;
 	p->pCompress = &CompressKernel;
 
+	p->pEstimate = &EstimateKernel;
+
+	p->pCacheCounters = &TakeBlockCacheCounters;
+	p->pCacheReset = &ResetBlockCache;
+
+	p->pShowBadBlocks = &ShowBadBlocks;
+
 	return true;
 }
+
+CORE_NAMESPACE_END
@@ -2,6 +2,19 @@
 
 #include "pch.h"
 
+struct BlockSSIM
+{
+	double Alpha, Color;
+
+	BlockSSIM(double alpha, double color) noexcept
+		: Alpha(alpha)
+		, Color(color)
+	{
+	}
+};
+
+CORE_NAMESPACE_BEGIN
+
 constexpr int kBlockMaximalAlphaError = 16 * (255 >> kDenoise) * (255 >> kDenoise) * kAlpha + 1;
 constexpr int kBlockMaximalColorError = 16 * (255 >> kDenoise) * (255 >> kDenoise) * kColor + 1;
 
@@ -22,17 +35,6 @@ struct BlockError
 	}
 };
 
-struct BlockSSIM
-{
-	double Alpha, Color;
-
-	BlockSSIM(double alpha, double color) noexcept
-		: Alpha(alpha)
-		, Color(color)
-	{
-	}
-};
-
 // A,G,R,B
 struct alignas(64) Area
 {
@@ -43,6 +45,9 @@ struct alignas(64) Area
 
 	bool IsOpaque;
 
+	// Color channels match, modes 4, 5 and 6 search them as one below /slow
+	bool IsGray;
+
 	uint8_t ZeroIndex;
 
 	int BestPca3;
@@ -70,6 +75,12 @@ struct alignas(64) Cell
 
 	int DenoiseStep;
 
+	// Partitions RankPartitions2 and RankPartitions3 keep
+	size_t PartitionsLimit;
+
+	// Rotations RankRotations keeps
+	size_t RotationsLimit;
+
 	bool IsOpaque;
 
 	uint64_t unused[2];
@@ -83,11 +94,32 @@ struct alignas(64) Cell
 
 	Area Area1;
 
-	bool LazyArea12[0x40], LazyArea22[0x40];
-	Area Area12[0x40], Area22[0x40];
+	struct AreaPool* Pool;
+	uint32_t Generation;
 
-	bool LazyArea13[0x40], LazyArea23[0x40], LazyArea33[0x40];
-	Area Area13[0x40], Area23[0x40], Area33[0x40];
+	uint8_t Slot12[0x40], Slot22[0x40];
+	uint8_t Slot13[0x40], Slot23[0x40], Slot33[0x40];
+};
+
+// Per-thread partition Areas, reused round-robin; an entry belongs to the Cell whose Generation and selection it holds.
+// Mode 2 walks 64 partitions of three subsets, so all its Areas of a block fit
+constexpr size_t kAreaPoolSize = 0x100;
+
+// A mode holds the Areas of its last GetArea calls, up to the three subsets of one partition
+constexpr size_t kAreaHeld = 3;
+
+struct alignas(64) AreaPool
+{
+	uint64_t Owners[kAreaPoolSize];
+	uint32_t Generations[kAreaPoolSize];
+
+	uint32_t Generation, Next;
+
+	// Entries of the last GetArea calls, replacement skips them
+	uint8_t Held[kAreaHeld];
+	uint8_t HeldNext;
+
+	Area Areas[kAreaPoolSize];
 };
 
 struct alignas(8) Node
@@ -125,16 +157,35 @@ struct alignas(64) Modulations
 
 NOTINLINED void MakeAreaFromCell(Area& area, const Cell& cell, const size_t count, uint64_t indices) noexcept;
 
-ALWAYS_INLINED Area& GetArea(Area& area, bool& lazy, const Cell& cell, const uint64_t indices) noexcept
+ALWAYS_INLINED bool IsAreaHeld(const AreaPool& pool, const size_t index) noexcept
+{
+	return (pool.Held[0] == index) | (pool.Held[1] == index) | (pool.Held[2] == index);
+}
+
+ALWAYS_INLINED Area& GetArea(uint8_t& slot, const Cell& cell, const uint64_t indices) noexcept
 {
-	if (lazy)
+	AreaPool& pool = *cell.Pool;
+
+	size_t index = slot & (kAreaPoolSize - 1);
+	if ((pool.Owners[index] != indices) || (pool.Generations[index] != cell.Generation))
 	{
-		lazy = false;
+		do
+		{
+			index = pool.Next++ & (kAreaPoolSize - 1);
+		} while (IsAreaHeld(pool, index));
 
-		MakeAreaFromCell(area, cell, indices & 0xF, indices >> 4);
+		slot = static_cast<uint8_t>(index);
+
+		pool.Owners[index] = indices;
+		pool.Generations[index] = cell.Generation;
+
+		MakeAreaFromCell(pool.Areas[index], cell, indices & 0xF, indices >> 4);
 	}
 
-	return area;
+	pool.Held[pool.HeldNext] = static_cast<uint8_t>(index);
+	pool.HeldNext = static_cast<uint8_t>((pool.HeldNext + 1) % kAreaHeld);
+
+	return pool.Areas[index];
 }
 
 int AreaGetBestPca3(Area& area) noexcept;
@@ -236,6 +287,9 @@ namespace Mode5 {
 
 	void CompressBlockFast(Cell& input) noexcept;
 
+	// Single color blocks, see IsSolidBlock
+	void CompressBlockSolid(Cell& input) noexcept;
+
 	void CompressBlock(Cell& input) noexcept;
 
 	void CompressBlockFull(Cell& input) noexcept;
@@ -282,6 +336,8 @@ void CompressStatistics();
 
 #endif
 
+CORE_NAMESPACE_END
+
 struct WorkerItem
 {
 	uint8_t* _Output;
@@ -300,15 +356,32 @@ struct WorkerItem
 	}
 };
 
-using PInitTables = void(*)(bool doDraft, bool doNormal, bool doSlow);
+// Effort levels from kEffortDraft to kEffortSlow search ever deeper, kEffortCompare only decompresses
+enum : int { kEffortCompare = -1, kEffortDraft = 0, kEffortNormal = 5, kEffortSlow = 10 };
+
+using PInitTables = void(*)(int effort);
 
 using PBlockKernel = void(*)(const WorkerItem* begin, const WorkerItem* end, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim) noexcept;
 
+using PBlockCost = void(*)(const WorkerItem* begin, const WorkerItem* end, int stride, uint32_t* costs) noexcept;
+
+using PCacheCounters = void(*)(int64_t& hits, int64_t& misses) noexcept;
+using PCacheReset = void(*)() noexcept;
+
+using PShowBadBlocks = void(*)(const uint8_t* src_bgra, const uint8_t* dst_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h) noexcept;
+
 struct IBc7Core
 {
 	PInitTables pInitTables;
 
 	PBlockKernel pDecompress, pCompress;
+
+	PBlockCost pEstimate;
+
+	PCacheCounters pCacheCounters;
+	PCacheReset pCacheReset;
+
+	PShowBadBlocks pShowBadBlocks;
 };
 
 //bool GetBc7Core(void* bc7Core);
@@ -2,12 +2,15 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "Bc7Rank.h"
 
 #include "SnippetDecompressIndexedSubset.h"
 #include "SnippetInsertRemoveZeroBit.h"
 #include "SnippetComputeOpaqueSubset3.h"
 #include "SnippetLevelsMinimum.h"
-#include "SnippetLevelsBuffer.h"
+#include "SnippetLevelsBufferHalf.h"
+
+CORE_NAMESPACE_BEGIN
 
 // https://docs.microsoft.com/en-us/windows/desktop/direct3d11/bc7-format-mode-reference#mode-1
 
@@ -121,8 +124,8 @@ namespace Mode1 {
 	{
 		const size_t partitionIndex = input.BestParameter;
 
-		Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
-		Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+		Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
+		Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 		__m128i mc0 = input.BestColor0;
 		__m128i mc1 = input.BestColor1;
@@ -184,13 +187,13 @@ namespace Mode1 {
 			int error = input.OpaqueAlphaError + denoiseStep;
 			if (error < input.Error.Total)
 			{
-				Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
+				Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
 
 				error += CompressSubsetFast(area1, mc0, input.Error.Total - error);
 
 				if (error < input.Error.Total)
 				{
-					Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+					Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 					error += CompressSubsetFast(area2, mc1, input.Error.Total - error);
 
@@ -219,24 +222,24 @@ namespace Mode1 {
 	class Subset final
 	{
 	public:
-		LevelsBuffer<LevelsCapacity> ch1, ch2, ch3;
+		LevelsBufferHalf<LevelsCapacity> ch1, ch2, ch3;
 
 		ALWAYS_INLINED Subset() noexcept = default;
 
 		template<int pbits>
 		INLINED bool InitLevels(const Area& area, const int water, const Estimation& estimation) noexcept
 		{
-			ch1.ComputeChannelLevelsReduced<6, pbits, false, gTableDeltas3_Value7Shared>(area, 1, kGreen, water - estimation.ch2 - estimation.ch3);
+			ch1.ComputeChannelLevelsReduced<6, pbits, false, gTableDeltas3Half_Value7Shared>(area, 1, kGreen, water - estimation.ch2 - estimation.ch3);
 			int min1 = ch1.MinErr;
 			if (min1 >= water)
 				return false;
 
-			ch2.ComputeChannelLevelsReduced<6, pbits, false, gTableDeltas3_Value7Shared>(area, 2, kRed, water - min1 - estimation.ch3);
+			ch2.ComputeChannelLevelsReduced<6, pbits, false, gTableDeltas3Half_Value7Shared>(area, 2, kRed, water - min1 - estimation.ch3);
 			int min2 = ch2.MinErr;
 			if (min1 + min2 >= water)
 				return false;
 
-			ch3.ComputeChannelLevelsReduced<6, pbits, false, gTableDeltas3_Value7Shared>(area, 3, kBlue, water - min1 - min2);
+			ch3.ComputeChannelLevelsReduced<6, pbits, false, gTableDeltas3Half_Value7Shared>(area, 3, kBlue, water - min1 - min2);
 			int min3 = ch3.MinErr;
 			if (min1 + min2 + min3 >= water)
 				return false;
@@ -390,7 +393,7 @@ namespace Mode1 {
 		int error = input.OpaqueAlphaError;
 		if (error < input.Error.Total)
 		{
-			Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
+			Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError3++;
@@ -409,7 +412,7 @@ namespace Mode1 {
 				}
 			}
 
-			Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+			Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError3++;
@@ -445,19 +448,19 @@ namespace Mode1 {
 		int error = 0;
 		if (error < water)
 		{
-			int level1 = LevelsMinimum::EstimateChannelLevelsReduced<7, false, gTableDeltas3_Value7Shared, gTableCuts3_Value7Shared>(area, 1, kGreen, water - error);
+			int level1 = LevelsMinimum::EstimateChannelLevelsReducedHalf<7, false, gTableDeltas3Half_Value7Shared, gTableCuts3_Value7Shared>(area, 1, kGreen, water - error);
 			estimation.ch1 = level1;
 			error += level1;
 
 			if (error < water)
 			{
-				int level2 = LevelsMinimum::EstimateChannelLevelsReduced<7, false, gTableDeltas3_Value7Shared, gTableCuts3_Value7Shared>(area, 2, kRed, water - error);
+				int level2 = LevelsMinimum::EstimateChannelLevelsReducedHalf<7, false, gTableDeltas3Half_Value7Shared, gTableCuts3_Value7Shared>(area, 2, kRed, water - error);
 				estimation.ch2 = level2;
 				error += level2;
 
 				if (error < water)
 				{
-					int level3 = LevelsMinimum::EstimateChannelLevelsReduced<7, false, gTableDeltas3_Value7Shared, gTableCuts3_Value7Shared>(area, 3, kBlue, water - error);
+					int level3 = LevelsMinimum::EstimateChannelLevelsReducedHalf<7, false, gTableDeltas3Half_Value7Shared, gTableCuts3_Value7Shared>(area, 3, kBlue, water - error);
 					estimation.ch3 = level3;
 					error += level3;
 
@@ -480,19 +483,21 @@ namespace Mode1 {
 
 		const int denoiseStep = input.DenoiseStep;
 
+		uint8_t partitions[64];
+		const size_t candidatesCount = RankPartitions2(input, partitions, false, 1);
+
 		size_t partitionsCount = 0;
-		for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
+		for (size_t candidateIndex = 0; candidateIndex < candidatesCount; candidateIndex++)
 		{
-			if ((input.PersonalMode == 1) && (input.PersonalParameter == partitionIndex))
-				continue;
+			const size_t partitionIndex = partitions[candidateIndex];
 
-			Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
+			Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
 
 			const int water1 = input.Error.Total - denoiseStep - input.OpaqueAlphaError;
 			int line1 = AreaGetBestPca3(area1);
 			if (line1 < water1)
 			{
-				Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+				Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 				const int water2 = water1 - line1;
 				int line2 = AreaGetBestPca3(area2);
@@ -523,8 +528,8 @@ namespace Mode1 {
 				__m128i mc0 = _mm_setzero_si128();
 				__m128i mc1 = _mm_setzero_si128();
 
-				Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
-				Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+				Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
+				Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 				int line1 = lines1[partitionIndex];
 				int line2 = lines2[partitionIndex];
@@ -584,3 +589,5 @@ namespace Mode1 {
 	}
 
 } // namespace Mode1
+
+CORE_NAMESPACE_END
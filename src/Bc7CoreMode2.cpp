@@ -2,6 +2,7 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "Bc7Rank.h"
 
 #include "SnippetDecompressIndexedSubset.h"
 #include "SnippetInsertRemoveZeroBit.h"
@@ -9,6 +10,8 @@
 #include "SnippetLevelsMinimum.h"
 #include "SnippetLevelsBuffer.h"
 
+CORE_NAMESPACE_BEGIN
+
 // https://docs.microsoft.com/en-us/windows/desktop/direct3d11/bc7-format-mode-reference#mode-2
 
 namespace Mode2 {
@@ -126,9 +129,9 @@ namespace Mode2 {
 	{
 		const size_t partitionIndex = input.BestParameter;
 
-		Area& area1 = GetArea(input.Area13[partitionIndex], input.LazyArea13[partitionIndex], input, gTableSelection13[partitionIndex]);
-		Area& area2 = GetArea(input.Area23[partitionIndex], input.LazyArea23[partitionIndex], input, gTableSelection23[partitionIndex]);
-		Area& area3 = GetArea(input.Area33[partitionIndex], input.LazyArea33[partitionIndex], input, gTableSelection33[partitionIndex]);
+		Area& area1 = GetArea(input.Slot13[partitionIndex], input, gTableSelection13[partitionIndex]);
+		Area& area2 = GetArea(input.Slot23[partitionIndex], input, gTableSelection23[partitionIndex]);
+		Area& area3 = GetArea(input.Slot33[partitionIndex], input, gTableSelection33[partitionIndex]);
 
 		__m128i mc0 = input.BestColor0;
 		__m128i mc1 = input.BestColor1;
@@ -175,19 +178,19 @@ namespace Mode2 {
 			int error = input.OpaqueAlphaError + denoiseStep;
 			if (error < input.Error.Total)
 			{
-				Area& area1 = GetArea(input.Area13[partitionIndex], input.LazyArea13[partitionIndex], input, gTableSelection13[partitionIndex]);
+				Area& area1 = GetArea(input.Slot13[partitionIndex], input, gTableSelection13[partitionIndex]);
 
 				error += CompressSubsetFast(area1, mc0, input.Error.Total - error);
 
 				if (error < input.Error.Total)
 				{
-					Area& area2 = GetArea(input.Area23[partitionIndex], input.LazyArea23[partitionIndex], input, gTableSelection23[partitionIndex]);
+					Area& area2 = GetArea(input.Slot23[partitionIndex], input, gTableSelection23[partitionIndex]);
 
 					error += CompressSubsetFast(area2, mc1, input.Error.Total - error);
 
 					if (error < input.Error.Total)
 					{
-						Area& area3 = GetArea(input.Area33[partitionIndex], input.LazyArea33[partitionIndex], input, gTableSelection33[partitionIndex]);
+						Area& area3 = GetArea(input.Slot33[partitionIndex], input, gTableSelection33[partitionIndex]);
 
 						error += CompressSubsetFast(area3, mc2, input.Error.Total - error);
 
@@ -354,7 +357,7 @@ namespace Mode2 {
 		int error = input.OpaqueAlphaError;
 		if (error < input.Error.Total)
 		{
-			Area& area1 = GetArea(input.Area13[partitionIndex], input.LazyArea13[partitionIndex], input, gTableSelection13[partitionIndex]);
+			Area& area1 = GetArea(input.Slot13[partitionIndex], input, gTableSelection13[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError2++;
@@ -373,7 +376,7 @@ namespace Mode2 {
 				}
 			}
 
-			Area& area2 = GetArea(input.Area23[partitionIndex], input.LazyArea23[partitionIndex], input, gTableSelection23[partitionIndex]);
+			Area& area2 = GetArea(input.Slot23[partitionIndex], input, gTableSelection23[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError2++;
@@ -392,7 +395,7 @@ namespace Mode2 {
 				}
 			}
 
-			Area& area3 = GetArea(input.Area33[partitionIndex], input.LazyArea33[partitionIndex], input, gTableSelection33[partitionIndex]);
+			Area& area3 = GetArea(input.Slot33[partitionIndex], input, gTableSelection33[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError2++;
@@ -467,25 +470,27 @@ namespace Mode2 {
 
 		const int denoiseStep = input.DenoiseStep;
 
+		uint8_t partitions[64];
+		const size_t candidatesCount = RankPartitions3(input, partitions, 64, 2);
+
 		size_t partitionsCount = 0;
-		for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
+		for (size_t candidateIndex = 0; candidateIndex < candidatesCount; candidateIndex++)
 		{
-			if ((input.PersonalMode == 2) && (input.PersonalParameter == partitionIndex))
-				continue;
+			const size_t partitionIndex = partitions[candidateIndex];
 
-			Area& area1 = GetArea(input.Area13[partitionIndex], input.LazyArea13[partitionIndex], input, gTableSelection13[partitionIndex]);
+			Area& area1 = GetArea(input.Slot13[partitionIndex], input, gTableSelection13[partitionIndex]);
 
 			const int water1 = input.Error.Total - denoiseStep - input.OpaqueAlphaError;
 			int line1 = EstimateLevels(area1, water1, estimations1[partitionIndex]);
 			if (line1 < water1)
 			{
-				Area& area2 = GetArea(input.Area23[partitionIndex], input.LazyArea23[partitionIndex], input, gTableSelection23[partitionIndex]);
+				Area& area2 = GetArea(input.Slot23[partitionIndex], input, gTableSelection23[partitionIndex]);
 
 				const int water2 = water1 - line1;
 				int line2 = EstimateLevels(area2, water2, estimations2[partitionIndex]);
 				if (line2 < water2)
 				{
-					Area& area3 = GetArea(input.Area33[partitionIndex], input.LazyArea33[partitionIndex], input, gTableSelection33[partitionIndex]);
+					Area& area3 = GetArea(input.Slot33[partitionIndex], input, gTableSelection33[partitionIndex]);
 
 					const int water3 = water2 - line2;
 					int line3 = EstimateLevels(area3, water3, estimations3[partitionIndex]);
@@ -520,7 +525,7 @@ namespace Mode2 {
 
 				const int line3 = lines3[partitionIndex];
 
-				Area& area1 = GetArea(input.Area13[partitionIndex], input.LazyArea13[partitionIndex], input, gTableSelection13[partitionIndex]);
+				Area& area1 = GetArea(input.Slot13[partitionIndex], input, gTableSelection13[partitionIndex]);
 
 				const int water1 = input.Error.Total - denoiseStep - input.OpaqueAlphaError - lines2[partitionIndex] - line3;
 				Subset subset1;
@@ -531,7 +536,7 @@ namespace Mode2 {
 					{
 						error += input.OpaqueAlphaError;
 
-						Area& area2 = GetArea(input.Area23[partitionIndex], input.LazyArea23[partitionIndex], input, gTableSelection23[partitionIndex]);
+						Area& area2 = GetArea(input.Slot23[partitionIndex], input, gTableSelection23[partitionIndex]);
 
 						const int water2 = input.Error.Total - denoiseStep - error - line3;
 						Subset subset2;
@@ -541,7 +546,7 @@ namespace Mode2 {
 
 							if (error < input.Error.Total - denoiseStep - line3)
 							{
-								Area& area3 = GetArea(input.Area33[partitionIndex], input.LazyArea33[partitionIndex], input, gTableSelection33[partitionIndex]);
+								Area& area3 = GetArea(input.Slot33[partitionIndex], input, gTableSelection33[partitionIndex]);
 
 								const int water3 = input.Error.Total - denoiseStep - error;
 								Subset subset3;
@@ -580,3 +585,5 @@ namespace Mode2 {
 	}
 
 } // namespace Mode2
+
+CORE_NAMESPACE_END
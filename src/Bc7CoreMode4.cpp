@@ -2,11 +2,14 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "Bc7Rank.h"
 
 #include "SnippetInsertRemoveZeroBit.h"
 #include "SnippetHorizontalSum4.h"
 #include "SnippetLevelsBuffer.h"
 
+CORE_NAMESPACE_BEGIN
+
 // https://docs.microsoft.com/en-us/windows/desktop/direct3d11/bc7-format-mode-reference#mode-4
 
 namespace Mode4 {
@@ -891,6 +894,13 @@ namespace Mode4 {
 			if (minA >= water)
 				return false;
 
+			if (area.IsGray && (rotation == 0))
+			{
+				chG.ComputeChannelLevelsReduced<5, -1, true, gTableDeltas2_Value5>(area, 1, kColor, water - minA);
+
+				return minA + chG.MinErr < water;
+			}
+
 			if (rotation == 2)
 			{
 				chG.ComputeChannelLevelsReduced<6, -1, true, gTableDeltas3_Value6, true>(area, 1, kGreen, water - minA);
@@ -930,9 +940,59 @@ namespace Mode4 {
 			return true;
 		}
 
+		// Levels of chG weighted by kColor stand for all color channels
+		INLINED int TryVariantsGray(const Area& area, __m128i& best_color, int water) noexcept
+		{
+			int minA = chA.MinErr;
+			int minG = chG.MinErr;
+			if (minA + minG >= water)
+				return water;
+
+			int nG = chG.Count;
+
+			int eA = minA;
+			int cA = chA.Err[0].Color;
+
+			for (int iG = 0; iG < nG; iG++)
+			{
+				int eG = chG.Err[iG].Error + eA;
+				if (eG >= water)
+					break;
+
+				int cG = chG.Err[iG].Color;
+
+				__m128i mc = _mm_setzero_si128();
+				mc = _mm_insert_epi16(mc, cA, 0);
+				mc = _mm_insert_epi16(mc, cG, 1);
+				mc = _mm_insert_epi16(mc, cG, 2);
+				mc = _mm_insert_epi16(mc, cG, 3);
+				mc = _mm_cvtepu8_epi16(mc);
+
+#if defined(OPTION_COUNTERS)
+				gComputeSubsetError23[0]++;
+#endif
+				int err = ComputeSubsetError23(area, mc, gWeightsAGRB, _mm_cvtsi32_si128(water), 0);
+
+				if (water > err)
+				{
+					water = err;
+
+					best_color = mc;
+				}
+			}
+
+			return water;
+		}
+
 		template<int rotation>
 		INLINED int TryVariants(const Area& area, __m128i& best_color, int water) noexcept
 		{
+			if constexpr (rotation == 0)
+			{
+				if (area.IsGray)
+					return TryVariantsGray(area, best_color, water);
+			}
+
 			int minA = chA.MinErr;
 			int minG = chG.MinErr;
 			int minR = chR.MinErr;
@@ -1137,6 +1197,13 @@ namespace Mode4 {
 			if (minA >= water)
 				return false;
 
+			if (area.IsGray && (rotation == 0 + 4))
+			{
+				chG.ComputeChannelLevelsReduced<5, -1, true, gTableDeltas3_Value5>(area, 1, kColor, water - minA);
+
+				return minA + chG.MinErr < water;
+			}
+
 			if (rotation == 2 + 4)
 			{
 				chG.ComputeChannelLevelsReduced<6, -1, true, gTableDeltas2_Value6, true>(area, 1, kGreen, water - minA);
@@ -1176,9 +1243,59 @@ namespace Mode4 {
 			return true;
 		}
 
+		// Levels of chG weighted by kColor stand for all color channels
+		INLINED int TryVariantsGray(const Area& area, __m128i& best_color, int water) noexcept
+		{
+			int minA = chA.MinErr;
+			int minG = chG.MinErr;
+			if (minA + minG >= water)
+				return water;
+
+			int nG = chG.Count;
+
+			int eA = minA;
+			int cA = chA.Err[0].Color;
+
+			for (int iG = 0; iG < nG; iG++)
+			{
+				int eG = chG.Err[iG].Error + eA;
+				if (eG >= water)
+					break;
+
+				int cG = chG.Err[iG].Color;
+
+				__m128i mc = _mm_setzero_si128();
+				mc = _mm_insert_epi16(mc, cA, 0);
+				mc = _mm_insert_epi16(mc, cG, 1);
+				mc = _mm_insert_epi16(mc, cG, 2);
+				mc = _mm_insert_epi16(mc, cG, 3);
+				mc = _mm_cvtepu8_epi16(mc);
+
+#if defined(OPTION_COUNTERS)
+				gComputeSubsetError32[0]++;
+#endif
+				int err = ComputeSubsetError32(area, mc, gWeightsAGRB, _mm_cvtsi32_si128(water), 0);
+
+				if (water > err)
+				{
+					water = err;
+
+					best_color = mc;
+				}
+			}
+
+			return water;
+		}
+
 		template<int rotation>
 		INLINED int TryVariants(const Area& area, __m128i& best_color, int water) noexcept
 		{
+			if constexpr (rotation == 0)
+			{
+				if (area.IsGray)
+					return TryVariantsGray(area, best_color, water);
+			}
+
 			int minA = chA.MinErr;
 			int minG = chG.MinErr;
 			int minR = chR.MinErr;
@@ -1444,12 +1561,12 @@ namespace Mode4 {
 	{
 		const int denoiseStep = input.DenoiseStep;
 
-		for (int rotationIndex = 0; rotationIndex < 8; rotationIndex++)
-		{
-			const int rotation = gRotationsMode4[rotationIndex];
+		int rotations[8];
+		const size_t candidatesCount = RankRotations(input, rotations, 4);
 
-			if ((input.PersonalMode == 4) && !((input.PersonalParameter ^ rotation) & 3))
-				continue;
+		for (size_t candidateIndex = 0; candidateIndex < candidatesCount; candidateIndex++)
+		{
+			const int rotation = rotations[candidateIndex];
 
 			__m128i mc = _mm_setzero_si128();
 
@@ -1501,3 +1618,5 @@ namespace Mode4 {
 	}
 
 } // namespace Mode4
+
+CORE_NAMESPACE_END
@@ -2,11 +2,14 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "Bc7Rank.h"
 
 #include "SnippetInsertRemoveZeroBit.h"
 #include "SnippetHorizontalSum4.h"
 #include "SnippetLevelsBuffer.h"
 
+CORE_NAMESPACE_BEGIN
+
 // https://docs.microsoft.com/en-us/windows/desktop/direct3d11/bc7-format-mode-reference#mode-5
 
 namespace Mode5 {
@@ -499,6 +502,36 @@ namespace Mode5 {
 		}
 	}
 
+	void CompressBlockSolid(Cell& input) noexcept
+	{
+		Area& area = input.Area1;
+
+		// Alpha stays 8-bit, colors take exact endpoints for index 1
+		const int alpha = _mm_extract_epi16(area.MinMax_U16, 0);
+
+		uint64_t packed = static_cast<uint64_t>(alpha | (alpha << 8));
+		packed |= static_cast<uint64_t>(gTableSolid2_Value7[_mm_extract_epi16(area.MinMax_U16, 2)]) << 16;
+		packed |= static_cast<uint64_t>(gTableSolid2_Value7[_mm_extract_epi16(area.MinMax_U16, 4)]) << 32;
+		packed |= static_cast<uint64_t>(gTableSolid2_Value7[_mm_extract_epi16(area.MinMax_U16, 6)]) << 48;
+
+		__m128i mc = _mm_cvtepu8_epi16(_mm_cvtsi64_si128(static_cast<int64_t>(packed)));
+
+#if defined(OPTION_COUNTERS)
+		gComputeSubsetError2[0]++;
+#endif
+
+		const int error = ComputeSubsetError2(area, mc, gWeightsAGRB, _mm_cvtsi32_si128(input.Error.Total), 0);
+
+		if (input.Error.Total > error)
+		{
+			input.Error.Total = error;
+
+			input.BestColor0 = mc;
+			input.BestParameter = 0;
+			input.BestMode = 5;
+		}
+	}
+
 	class Subset final
 	{
 	public:
@@ -527,6 +560,13 @@ namespace Mode5 {
 			if (minA >= water)
 				return false;
 
+			if (area.IsGray && (rotation == 0))
+			{
+				chG.ComputeChannelLevelsReduced<7, -1, true, gTableDeltas2_Value7>(area, 1, kColor, water - minA);
+
+				return minA + chG.MinErr < water;
+			}
+
 			if (rotation == 2)
 			{
 				chG.ComputeChannelLevelsReduced<8, -1, true, gTableDeltas2_Value8, true>(area, 1, kGreen, water - minA);
@@ -566,9 +606,59 @@ namespace Mode5 {
 			return true;
 		}
 
+		// Levels of chG weighted by kColor stand for all color channels
+		INLINED int TryVariantsGray(const Area& area, __m128i& best_color, int water) noexcept
+		{
+			int minA = chA.MinErr;
+			int minG = chG.MinErr;
+			if (minA + minG >= water)
+				return water;
+
+			int nG = chG.Count;
+
+			int eA = minA;
+			int cA = chA.Err[0].Color;
+
+			for (int iG = 0; iG < nG; iG++)
+			{
+				int eG = chG.Err[iG].Error + eA;
+				if (eG >= water)
+					break;
+
+				int cG = chG.Err[iG].Color;
+
+				__m128i mc = _mm_setzero_si128();
+				mc = _mm_insert_epi16(mc, cA, 0);
+				mc = _mm_insert_epi16(mc, cG, 1);
+				mc = _mm_insert_epi16(mc, cG, 2);
+				mc = _mm_insert_epi16(mc, cG, 3);
+				mc = _mm_cvtepu8_epi16(mc);
+
+#if defined(OPTION_COUNTERS)
+				gComputeSubsetError2[0]++;
+#endif
+				int err = ComputeSubsetError2(area, mc, gWeightsAGRB, _mm_cvtsi32_si128(water), 0);
+
+				if (water > err)
+				{
+					water = err;
+
+					best_color = mc;
+				}
+			}
+
+			return water;
+		}
+
 		template<int rotation>
 		INLINED int TryVariants(const Area& area, __m128i& best_color, int water) noexcept
 		{
+			if constexpr (rotation == 0)
+			{
+				if (area.IsGray)
+					return TryVariantsGray(area, best_color, water);
+			}
+
 			int minA = chA.MinErr;
 			int minG = chG.MinErr;
 			int minR = chR.MinErr;
@@ -800,12 +890,12 @@ namespace Mode5 {
 	{
 		const int denoiseStep = input.DenoiseStep;
 
-		for (int rotationIndex = 0; rotationIndex < 4; rotationIndex++)
-		{
-			const int rotation = gRotationsMode5[rotationIndex];
+		int rotations[8];
+		const size_t candidatesCount = RankRotations(input, rotations, 5);
 
-			if ((input.PersonalMode == 5) && (input.PersonalParameter == rotation))
-				continue;
+		for (size_t candidateIndex = 0; candidateIndex < candidatesCount; candidateIndex++)
+		{
+			const int rotation = rotations[candidateIndex];
 
 			__m128i mc = _mm_setzero_si128();
 
@@ -847,3 +937,5 @@ namespace Mode5 {
 	}
 
 } // namespace Mode5
+
+CORE_NAMESPACE_END
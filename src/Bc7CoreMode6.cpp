@@ -7,6 +7,8 @@
 #include "SnippetInsertRemoveZeroBit.h"
 #include "SnippetLevelsBufferHalf.h"
 
+CORE_NAMESPACE_BEGIN
+
 // https://docs.microsoft.com/en-us/windows/desktop/direct3d11/bc7-format-mode-reference#mode-6
 
 namespace Mode6 {
@@ -109,7 +111,7 @@ namespace Mode6 {
 		if (error)
 		{
 			error *= kAlpha;
-			int v = (gTableDeltas4Half_Value8[0][alpha >> 1] >> ((alpha & 1) << 2)) & 0xF;
+			int v = (gLevelTables->Deltas4Half_Value8[0][LevelTileOffset(static_cast<size_t>(alpha >> 1), gLevelTables->TileStep())] >> ((alpha & 1) << 2)) & 0xF;
 			error *= v * v;
 		}
 
@@ -757,6 +759,13 @@ namespace Mode6 {
 			if (min0 >= water)
 				return false;
 
+			if (area.IsGray)
+			{
+				ch1.ComputeChannelLevelsReduced<7, pbits, true, gTableDeltas4Half_Value8>(area, 1, kColor, water - min0);
+
+				return min0 + ch1.MinErr < water;
+			}
+
 			ch1.ComputeChannelLevelsReduced<7, pbits, true, gTableDeltas4Half_Value8>(area, 1, kGreen, water - min0);
 			int min1 = ch1.MinErr;
 			if (min0 + min1 >= water)
@@ -775,8 +784,64 @@ namespace Mode6 {
 			return true;
 		}
 
+		// Levels of ch1 weighted by kColor stand for all color channels
+		INLINED int TryVariantsGray(const Area& area, __m128i& best_color, int water) noexcept
+		{
+			int min0 = ch0.MinErr;
+			int min1 = ch1.MinErr;
+			if (min0 + min1 >= water)
+				return water;
+
+			int n0 = ch0.Count;
+			int n1 = ch1.Count;
+
+			for (int i0 = 0; i0 < n0; i0++)
+			{
+				int e0 = ch0.Err[i0].Error;
+				if (e0 + min1 >= water)
+					break;
+
+				int c0 = ch0.Err[i0].Color;
+
+				const int ea = ComputeSubsetTransparentError4(area, c0);
+
+				for (int i1 = 0; i1 < n1; i1++)
+				{
+					int e1 = ch1.Err[i1].Error + e0;
+					if (e1 >= water)
+						break;
+
+					int c1 = ch1.Err[i1].Color;
+
+					__m128i mc = _mm_setzero_si128();
+					mc = _mm_insert_epi16(mc, c0, 0);
+					mc = _mm_insert_epi16(mc, c1, 1);
+					mc = _mm_insert_epi16(mc, c1, 2);
+					mc = _mm_insert_epi16(mc, c1, 3);
+					mc = _mm_cvtepu8_epi16(mc);
+
+#if defined(OPTION_COUNTERS)
+					gComputeSubsetError4++;
+#endif
+					int err = ComputeSubsetError4(area, mc, gWeightsAGRB, _mm_cvtsi32_si128(water - ea)) + ea;
+
+					if (water > err)
+					{
+						water = err;
+
+						best_color = mc;
+					}
+				}
+			}
+
+			return water;
+		}
+
 		INLINED int TryVariants(const Area& area, __m128i& best_color, int water) noexcept
 		{
+			if (area.IsGray)
+				return TryVariantsGray(area, best_color, water);
+
 			int min0 = ch0.MinErr;
 			int min1 = ch1.MinErr;
 			int min2 = ch2.MinErr;
@@ -1032,3 +1097,5 @@ namespace Mode6 {
 	}
 
 } // namespace Mode6
+
+CORE_NAMESPACE_END
@@ -2,12 +2,15 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "Bc7Rank.h"
 #include "Bc7Pca.h"
 
 #include "SnippetDecompressIndexedSubset.h"
 #include "SnippetInsertRemoveZeroBit.h"
 #include "SnippetLevelsMinimum.h"
-#include "SnippetLevelsBuffer.h"
+#include "SnippetLevelsBufferHalf.h"
+
+CORE_NAMESPACE_BEGIN
 
 // https://docs.microsoft.com/en-us/windows/desktop/direct3d11/bc7-format-mode-reference#mode-7
 
@@ -130,7 +133,7 @@ namespace Mode7 {
 		if (error)
 		{
 			error *= kAlpha;
-			int v = gTableDeltas2_Value8[0][alpha];
+			int v = gLevelTables->Deltas2_Value8[0][LevelTileOffset(static_cast<size_t>(alpha), gLevelTables->TileStep())];
 			error *= v * v;
 		}
 
@@ -525,8 +528,8 @@ namespace Mode7 {
 	{
 		const size_t partitionIndex = input.BestParameter;
 
-		Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
-		Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+		Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
+		Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 		__m128i mc0 = input.BestColor0;
 		__m128i mc1 = input.BestColor1;
@@ -578,13 +581,13 @@ namespace Mode7 {
 			int error = denoiseStep;
 			if (error < input.Error.Total)
 			{
-				Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
+				Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
 
 				error += CompressSubsetFast(area1, mc0, input.Error.Total - error);
 
 				if (error < input.Error.Total)
 				{
-					Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+					Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 					error += CompressSubsetFast(area2, mc1, input.Error.Total - error);
 
@@ -613,7 +616,7 @@ namespace Mode7 {
 	class Subset final
 	{
 	public:
-		LevelsBuffer<LevelsCapacity> ch0, ch1, ch2, ch3;
+		LevelsBufferHalf<LevelsCapacity> ch0, ch1, ch2, ch3;
 
 		ALWAYS_INLINED Subset() noexcept = default;
 
@@ -626,23 +629,23 @@ namespace Mode7 {
 			}
 			else
 			{
-				ch0.ComputeChannelLevelsReduced<5, pbits, false, gTableDeltas2_Value6>(area, 0, kAlpha, water - estimation.ch1 - estimation.ch2 - estimation.ch3);
+				ch0.ComputeChannelLevelsReduced<5, pbits, false, gTableDeltas2Half_Value6>(area, 0, kAlpha, water - estimation.ch1 - estimation.ch2 - estimation.ch3);
 			}
 			int min0 = ch0.MinErr;
 			if (min0 >= water)
 				return false;
 
-			ch1.ComputeChannelLevelsReduced<5, pbits, true, gTableDeltas2_Value6>(area, 1, kGreen, water - min0 - estimation.ch2 - estimation.ch3);
+			ch1.ComputeChannelLevelsReduced<5, pbits, true, gTableDeltas2Half_Value6>(area, 1, kGreen, water - min0 - estimation.ch2 - estimation.ch3);
 			int min1 = ch1.MinErr;
 			if (min0 + min1 >= water)
 				return false;
 
-			ch2.ComputeChannelLevelsReduced<5, pbits, true, gTableDeltas2_Value6>(area, 2, kRed, water - min0 - min1 - estimation.ch3);
+			ch2.ComputeChannelLevelsReduced<5, pbits, true, gTableDeltas2Half_Value6>(area, 2, kRed, water - min0 - min1 - estimation.ch3);
 			int min2 = ch2.MinErr;
 			if (min0 + min1 + min2 >= water)
 				return false;
 
-			ch3.ComputeChannelLevelsReduced<5, pbits, true, gTableDeltas2_Value6>(area, 3, kBlue, water - min0 - min1 - min2);
+			ch3.ComputeChannelLevelsReduced<5, pbits, true, gTableDeltas2Half_Value6>(area, 3, kBlue, water - min0 - min1 - min2);
 			int min3 = ch3.MinErr;
 			if (min0 + min1 + min2 + min3 >= water)
 				return false;
@@ -872,7 +875,7 @@ namespace Mode7 {
 
 		int error = 0;
 		{
-			Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
+			Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError2++;
@@ -892,7 +895,7 @@ namespace Mode7 {
 				}
 			}
 
-			Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+			Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 #if defined(OPTION_COUNTERS)
 			gComputeSubsetError2++;
@@ -955,7 +958,7 @@ namespace Mode7 {
 
 			if (!area.IsOpaque)
 			{
-				int level0 = LevelsMinimum::EstimateChannelLevelsReduced<6, false, gTableDeltas2_Value6, gTableCuts2_Value6>(area, 0, kAlpha, water - error);
+				int level0 = LevelsMinimum::EstimateChannelLevelsReducedHalf<6, false, gTableDeltas2Half_Value6, gTableCuts2_Value6>(area, 0, kAlpha, water - error);
 				estimation.ch0 = level0;
 				error += level0;
 			}
@@ -966,19 +969,19 @@ namespace Mode7 {
 
 			if (error < water)
 			{
-				int level1 = LevelsMinimum::EstimateChannelLevelsReduced<6, true, gTableDeltas2_Value6, gTableCuts2_Value6>(area, 1, kGreen, water - error);
+				int level1 = LevelsMinimum::EstimateChannelLevelsReducedHalf<6, true, gTableDeltas2Half_Value6, gTableCuts2_Value6>(area, 1, kGreen, water - error);
 				estimation.ch1 = level1;
 				error += level1;
 
 				if (error < water)
 				{
-					int level2 = LevelsMinimum::EstimateChannelLevelsReduced<6, true, gTableDeltas2_Value6, gTableCuts2_Value6>(area, 2, kRed, water - error);
+					int level2 = LevelsMinimum::EstimateChannelLevelsReducedHalf<6, true, gTableDeltas2Half_Value6, gTableCuts2_Value6>(area, 2, kRed, water - error);
 					estimation.ch2 = level2;
 					error += level2;
 
 					if (error < water)
 					{
-						int level3 = LevelsMinimum::EstimateChannelLevelsReduced<6, true, gTableDeltas2_Value6, gTableCuts2_Value6>(area, 3, kBlue, water - error);
+						int level3 = LevelsMinimum::EstimateChannelLevelsReducedHalf<6, true, gTableDeltas2Half_Value6, gTableCuts2_Value6>(area, 3, kBlue, water - error);
 						estimation.ch3 = level3;
 						error += level3;
 
@@ -1002,19 +1005,21 @@ namespace Mode7 {
 
 		const int denoiseStep = input.DenoiseStep;
 
+		uint8_t partitions[64];
+		const size_t candidatesCount = RankPartitions2(input, partitions, !input.Area1.IsOpaque, 7);
+
 		size_t partitionsCount = 0;
-		for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
+		for (size_t candidateIndex = 0; candidateIndex < candidatesCount; candidateIndex++)
 		{
-			if ((input.PersonalMode == 7) && (input.PersonalParameter == partitionIndex))
-				continue;
+			const size_t partitionIndex = partitions[candidateIndex];
 
-			Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
+			Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
 
 			const int water1 = input.Error.Total - denoiseStep;
 			int line1 = EstimateBest(area1);
 			if (line1 < water1)
 			{
-				Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+				Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 				const int water2 = water1 - line1;
 				int line2 = EstimateBest(area2);
@@ -1045,8 +1050,8 @@ namespace Mode7 {
 				__m128i mc0 = _mm_setzero_si128();
 				__m128i mc1 = _mm_setzero_si128();
 
-				Area& area1 = GetArea(input.Area12[partitionIndex], input.LazyArea12[partitionIndex], input, gTableSelection12[partitionIndex]);
-				Area& area2 = GetArea(input.Area22[partitionIndex], input.LazyArea22[partitionIndex], input, gTableSelection22[partitionIndex]);
+				Area& area1 = GetArea(input.Slot12[partitionIndex], input, gTableSelection12[partitionIndex]);
+				Area& area2 = GetArea(input.Slot22[partitionIndex], input, gTableSelection22[partitionIndex]);
 
 				int line1 = lines1[partitionIndex];
 				int line2 = lines2[partitionIndex];
@@ -1106,3 +1111,5 @@ namespace Mode7 {
 	}
 
 } // namespace Mode7
+
+CORE_NAMESPACE_END
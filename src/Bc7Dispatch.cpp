@@ -0,0 +1,137 @@
+
+#include "pch.h"
+#include "Bc7Core.h"
+
+#if defined(OPTION_DISPATCH)
+
+#if defined(WIN32)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include <stdlib.h>
+
+// Bc7Core*.vcxproj, the core built once per ISA, see Bc7Mode.h
+namespace CoreSSSE3 { bool GetBc7Core(void* bc7Core); }
+namespace CoreSSE41 { bool GetBc7Core(void* bc7Core); }
+namespace CoreAVX2 { bool GetBc7Core(void* bc7Core); }
+namespace CoreAVX512 { bool GetBc7Core(void* bc7Core); }
+
+using PGetBc7Core = bool(*)(void* bc7Core);
+
+struct CoreEntry
+{
+	const char* Name;
+
+	PGetBc7Core GetBc7Core;
+};
+
+// Each entry needs every one before it
+static const CoreEntry gCores[] =
+{
+	{ "ssse3", &CoreSSSE3::GetBc7Core },
+	{ "sse41", &CoreSSE41::GetBc7Core },
+	{ "avx2", &CoreAVX2::GetBc7Core },
+	{ "avx512", &CoreAVX512::GetBc7Core }
+};
+
+static void ReadCpuid(uint32_t leaf, uint32_t regs[4]) noexcept
+{
+#if defined(WIN32)
+	int info[4];
+	__cpuidex(info, static_cast<int>(leaf), 0);
+
+	for (size_t i = 0; i < 4; i++)
+	{
+		regs[i] = static_cast<uint32_t>(info[i]);
+	}
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switches
+static uint64_t ReadXcr0() noexcept
+{
+#if defined(WIN32)
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+
+	return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+static INLINED bool HasBits(uint32_t value, uint32_t bits) noexcept
+{
+	return (value & bits) == bits;
+}
+
+// Number of leading gCores entries the CPU and the OS support
+static size_t DetectCores() noexcept
+{
+	uint32_t regs[4];
+
+	ReadCpuid(0, regs);
+	const uint32_t leafs = regs[0];
+	if (leafs < 1)
+		return 0;
+
+	ReadCpuid(1, regs);
+	const uint32_t ecx1 = regs[2];
+
+	if (!HasBits(ecx1, 1u << 9))
+		return 0;
+
+	if (!HasBits(ecx1, 1u << 19))
+		return 1;
+
+	// OSXSAVE, AVX, FMA
+	if ((leafs < 7) || !HasBits(ecx1, (1u << 27) | (1u << 28) | (1u << 12)))
+		return 2;
+
+	const uint64_t xcr0 = ReadXcr0();
+	if ((xcr0 & 0x6) != 0x6)
+		return 2;
+
+	ReadCpuid(7, regs);
+	const uint32_t ebx7 = regs[1];
+
+	// AVX2, BMI1, BMI2
+	if (!HasBits(ebx7, (1u << 5) | (1u << 3) | (1u << 8)))
+		return 2;
+
+	// AVX512 F, DQ, BW, VL and the opmask and upper ZMM state
+	if (!HasBits(ebx7, (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31)) || ((xcr0 & 0xE6) != 0xE6))
+		return 3;
+
+	return 4;
+}
+
+bool GetBc7Core(void* bc7Core)
+{
+	size_t count = DetectCores();
+
+	// NEBC7_ISA=sse41 and alike cap the choice, for comparisons
+	const char* isa = getenv("NEBC7_ISA");
+	if (isa != nullptr)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (strcmp(isa, gCores[i].Name) == 0)
+			{
+				count = i + 1;
+				break;
+			}
+		}
+	}
+
+	if (count == 0)
+		return false;
+
+	return gCores[count - 1].GetBc7Core(bc7Core);
+}
+
+#endif
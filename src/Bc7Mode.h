@@ -1,11 +1,35 @@
 
+// OPTION_DISPATCH builds the core once per ISA, each into its own namespace, and GetBc7Core picks one by cpuid.
+// The Bc7Core* projects define OPTION_CORE_*, the rest of the program runs on any SSSE3 CPU
+#if defined(OPTION_DISPATCH)
+
+#if defined(OPTION_CORE_AVX512)
+#define OPTION_AVX512
+#define OPTION_CORE_NAMESPACE CoreAVX512
+#elif defined(OPTION_CORE_AVX2)
+#define OPTION_AVX2
+#define OPTION_CORE_NAMESPACE CoreAVX2
+#elif defined(OPTION_CORE_SSE41)
+#define OPTION_CORE_NAMESPACE CoreSSE41
+#elif defined(OPTION_CORE_SSSE3)
+#define OPTION_SLOWPOKE
+#define OPTION_CORE_NAMESPACE CoreSSSE3
+#else
+#define OPTION_SLOWPOKE
+#endif
+
+#else
+
 //#define OPTION_AVX512
 #define OPTION_AVX2
+//#define OPTION_SLOWPOKE
+
+#endif
+
 //#define OPTION_FMA
 //#define OPTION_PCA
 //#define OPTION_COUNTERS
 //#define OPTION_LINEAR
-//#define OPTION_SLOWPOKE
 #define OPTION_SELFCHECK
 
 #if defined(OPTION_LINEAR)
@@ -25,6 +49,10 @@ enum { kColor = kGreen + kRed + kBlue };
 //enum { kDenoise = 1, kDenoiseStep = 0 };
 enum { kDenoise = 1, kDenoiseStep = 3 * 3 };
 
+#if defined(OPTION_DISPATCH) && defined(OPTION_COUNTERS)
+#error Counters need a single ISA build
+#endif
+
 #if defined(OPTION_AVX512) && (!defined(__AVX512F__) || !defined(__AVX512BW__) || !defined(__AVX512VL__) || defined(OPTION_SLOWPOKE))
 #error AVX-512 is required
 #endif
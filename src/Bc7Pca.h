@@ -3,6 +3,8 @@
 #include "pch.h"
 #include "Bc7Core.h"
 
+CORE_NAMESPACE_BEGIN
+
 #if defined(OPTION_PCA)
 
 int PrincipalComponentAnalysis3(const Area& area);
@@ -11,3 +13,5 @@ int PrincipalComponentAnalysis4(const Area& area);
 void InitPCA() noexcept;
 
 #endif
+
+CORE_NAMESPACE_END
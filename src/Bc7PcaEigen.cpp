@@ -10,6 +10,8 @@
 #define EIGEN_FAST_MATH 1
 #include "Eigen/SVD" // Eigen 3.3.7 is required
 
+CORE_NAMESPACE_BEGIN
+
 static ALWAYS_INLINED __m128 FMS_ps(__m128 a, __m128 b, __m128 c)
 {
 #if defined(OPTION_FMA)
@@ -194,4 +196,6 @@ void InitPCA() noexcept
 	_mm_store_ps(InvK4, mik);
 }
 
+CORE_NAMESPACE_END
+
 #endif
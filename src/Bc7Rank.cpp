@@ -0,0 +1,563 @@
+
+#include "pch.h"
+#include "Bc7Rank.h"
+#include "Bc7Tables.h"
+
+CORE_NAMESPACE_BEGIN
+
+// Squares of halved values fit the words of the pixel pairs
+constexpr int kRankShift = 1;
+
+// Pixel pairs 2j and 2j + 1 as the words of a dword, 1 when the pixel is in the subset
+alignas(64) static int gRankMasks12[8][64];
+alignas(64) static int gRankMasks13[8][64];
+alignas(64) static int gRankMasks23[8][64];
+
+// A,G,R,B
+static float gRankWeights[4][4];
+
+static void MakeRankMasks(int masks[8][64], const uint64_t selections[64]) noexcept
+{
+	for (size_t partitionIndex = 0; partitionIndex < 64; partitionIndex++)
+	{
+		for (size_t j = 0; j < 8; j++)
+		{
+			masks[j][partitionIndex] = 0;
+		}
+
+		uint64_t indices = selections[partitionIndex];
+
+		for (size_t i = 0, n = indices & 0xF; i < n; i++)
+		{
+			indices >>= 4;
+
+			const size_t index = indices & 0xF;
+
+			masks[index >> 1][partitionIndex] |= 1 << ((index & 1) << 4);
+		}
+	}
+}
+
+void InitRank() noexcept
+{
+	MakeRankMasks(gRankMasks12, gTableSelection12);
+	MakeRankMasks(gRankMasks13, gTableSelection13);
+	MakeRankMasks(gRankMasks23, gTableSelection23);
+
+	const float weights[4] = { kAlpha, kGreen, kRed, kBlue };
+
+	for (size_t c = 0; c < 4; c++)
+	{
+		for (size_t d = 0; d < 4; d++)
+		{
+			gRankWeights[c][d] = sqrtf(weights[c] * weights[d]);
+		}
+	}
+}
+
+// 1, x and xy of the channels from first on
+template<int first>
+struct Moments
+{
+	static constexpr int Channels = 4 - first;
+
+	static constexpr int Count = 1 + Channels + Channels * (Channels + 1) / 2;
+};
+
+// Moments of the visible pixels, pixel pairs as the words of a dword
+template<int first>
+static ALWAYS_INLINED void MakeMoments(const Cell& cell, int pairs[Moments<first>::Count][8]) noexcept
+{
+	for (size_t k = 0; k < Moments<first>::Count; k++)
+	{
+		for (size_t j = 0; j < 8; j++)
+		{
+			pairs[k][j] = 0;
+		}
+	}
+
+	for (size_t i = 0; i < 16; i++)
+	{
+		if (!(cell.VisibleFlags & (1 << i)))
+			continue;
+
+		alignas(16) uint16_t pixel[8];
+		_mm_store_si128((__m128i*)pixel, cell.DataMask_I16[i]);
+
+		int* p = &pairs[0][i >> 1];
+		const int shift = static_cast<int>((i & 1) << 4);
+
+		p[0] |= 1 << shift;
+		p += 8;
+
+		for (int c = first; c < 4; c++)
+		{
+			p[0] |= (pixel[c] >> kRankShift) << shift;
+			p += 8;
+		}
+
+		for (int c = first; c < 4; c++)
+		{
+			for (int d = c; d < 4; d++)
+			{
+				p[0] |= ((pixel[c] >> kRankShift) * (pixel[d] >> kRankShift)) << shift;
+				p += 8;
+			}
+		}
+	}
+}
+
+// Moments of a subset for every partition, count is a multiple of 16
+template<int moments>
+static ALWAYS_INLINED void SumSubsets(int sums[moments][64], const int pairs[moments][8], const int masks[8][64], size_t count) noexcept
+{
+	for (size_t k = 0; k < moments; k++)
+	{
+#if defined(OPTION_AVX512)
+		for (size_t q = 0; q < count; q += 16)
+		{
+			__m512i wsum = _mm512_setzero_si512();
+
+			for (size_t j = 0; j < 8; j++)
+			{
+				wsum = _mm512_add_epi32(wsum, _mm512_madd_epi16(_mm512_load_si512((const __m512i*)&masks[j][q]), _mm512_set1_epi32(pairs[k][j])));
+			}
+
+			_mm512_store_si512((__m512i*)&sums[k][q], wsum);
+		}
+#elif defined(OPTION_AVX2)
+		for (size_t q = 0; q < count; q += 8)
+		{
+			__m256i vsum = _mm256_setzero_si256();
+
+			for (size_t j = 0; j < 8; j++)
+			{
+				vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(_mm256_load_si256((const __m256i*)&masks[j][q]), _mm256_set1_epi32(pairs[k][j])));
+			}
+
+			_mm256_store_si256((__m256i*)&sums[k][q], vsum);
+		}
+#else
+		for (size_t q = 0; q < count; q += 4)
+		{
+			__m128i msum = _mm_setzero_si128();
+
+			for (size_t j = 0; j < 8; j++)
+			{
+				msum = _mm_add_epi32(msum, _mm_madd_epi16(_mm_load_si128((const __m128i*)&masks[j][q]), _mm_set1_epi32(pairs[k][j])));
+			}
+
+			_mm_store_si128((__m128i*)&sums[k][q], msum);
+		}
+#endif
+	}
+}
+
+template<int moments>
+static ALWAYS_INLINED void SumTotals(int totals[moments], const int pairs[moments][8]) noexcept
+{
+	for (size_t k = 0; k < moments; k++)
+	{
+		int total = 0;
+
+		for (size_t j = 0; j < 8; j++)
+		{
+			total += (pairs[k][j] & 0xFFFF) + (pairs[k][j] >> 16);
+		}
+
+		totals[k] = total;
+	}
+}
+
+// Weighted scatter less its largest eigenvalue, taken as the Rayleigh quotient of the scatter times 1,1,1
+template<int first>
+static ALWAYS_INLINED __m128 EstimateLineError(const __m128 m[Moments<first>::Count]) noexcept
+{
+	constexpr int channels = Moments<first>::Channels;
+
+	const __m128 mrn = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(m[0], _mm_set1_ps(1.0f)));
+
+	__m128 cov[channels][channels];
+
+	for (int c = 0, k = 1 + channels; c < channels; c++)
+	{
+		for (int d = c; d < channels; d++, k++)
+		{
+			__m128 mx = _mm_sub_ps(m[k], _mm_mul_ps(_mm_mul_ps(m[1 + c], m[1 + d]), mrn));
+
+			mx = _mm_mul_ps(mx, _mm_set1_ps(gRankWeights[first + c][first + d]));
+
+			cov[c][d] = mx;
+			cov[d][c] = mx;
+		}
+	}
+
+	__m128 mtrace = cov[0][0];
+	__m128 v[channels];
+
+	for (int c = 0; c < channels; c++)
+	{
+		if (c > 0)
+		{
+			mtrace = _mm_add_ps(mtrace, cov[c][c]);
+		}
+
+		v[c] = cov[c][0];
+
+		for (int d = 1; d < channels; d++)
+		{
+			v[c] = _mm_add_ps(v[c], cov[c][d]);
+		}
+	}
+
+	__m128 mnum = _mm_setzero_ps();
+	__m128 mden = _mm_setzero_ps();
+
+	for (int c = 0; c < channels; c++)
+	{
+		__m128 mu = _mm_mul_ps(cov[c][0], v[0]);
+
+		for (int d = 1; d < channels; d++)
+		{
+			mu = _mm_add_ps(mu, _mm_mul_ps(cov[c][d], v[d]));
+		}
+
+		mnum = _mm_add_ps(mnum, _mm_mul_ps(mu, v[c]));
+		mden = _mm_add_ps(mden, _mm_mul_ps(v[c], v[c]));
+	}
+
+	const __m128 mlambda = _mm_div_ps(mnum, _mm_max_ps(mden, _mm_set1_ps(1.0f)));
+
+	return _mm_max_ps(_mm_sub_ps(mtrace, mlambda), _mm_setzero_ps());
+}
+
+template<int first>
+static ALWAYS_INLINED void EstimatePartitions2(const Cell& cell, int estimations[64]) noexcept
+{
+	constexpr int moments = Moments<first>::Count;
+
+	alignas(16) int pairs[moments][8];
+	MakeMoments<first>(cell, pairs);
+
+	alignas(64) int sums1[moments][64];
+	SumSubsets<moments>(sums1, pairs, gRankMasks12, 64);
+
+	int totals[moments];
+	SumTotals<moments>(totals, pairs);
+
+	for (size_t q = 0; q < 64; q += 4)
+	{
+		__m128 m1[moments], m2[moments];
+
+		for (size_t k = 0; k < moments; k++)
+		{
+			const __m128i msum1 = _mm_load_si128((const __m128i*)&sums1[k][q]);
+
+			m1[k] = _mm_cvtepi32_ps(msum1);
+			m2[k] = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_set1_epi32(totals[k]), msum1));
+		}
+
+		const __m128 merror = _mm_add_ps(EstimateLineError<first>(m1), EstimateLineError<first>(m2));
+
+		_mm_store_si128((__m128i*)&estimations[q], _mm_cvtps_epi32(merror));
+	}
+}
+
+static void EstimatePartitions3(const Cell& cell, int estimations[64], size_t count) noexcept
+{
+	constexpr int moments = Moments<1>::Count;
+
+	alignas(16) int pairs[moments][8];
+	MakeMoments<1>(cell, pairs);
+
+	alignas(64) int sums1[moments][64];
+	alignas(64) int sums2[moments][64];
+	SumSubsets<moments>(sums1, pairs, gRankMasks13, count);
+	SumSubsets<moments>(sums2, pairs, gRankMasks23, count);
+
+	int totals[moments];
+	SumTotals<moments>(totals, pairs);
+
+	for (size_t q = 0; q < count; q += 4)
+	{
+		__m128 m1[moments], m2[moments], m3[moments];
+
+		for (size_t k = 0; k < moments; k++)
+		{
+			const __m128i msum1 = _mm_load_si128((const __m128i*)&sums1[k][q]);
+			const __m128i msum2 = _mm_load_si128((const __m128i*)&sums2[k][q]);
+
+			m1[k] = _mm_cvtepi32_ps(msum1);
+			m2[k] = _mm_cvtepi32_ps(msum2);
+			m3[k] = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_sub_epi32(_mm_set1_epi32(totals[k]), msum1), msum2));
+		}
+
+		const __m128 merror = _mm_add_ps(_mm_add_ps(EstimateLineError<1>(m1), EstimateLineError<1>(m2)), EstimateLineError<1>(m3));
+
+		_mm_store_si128((__m128i*)&estimations[q], _mm_cvtps_epi32(merror));
+	}
+}
+
+static INLINED bool IsPersonal(const Cell& cell, size_t partitionIndex, uint32_t mode) noexcept
+{
+	return (cell.PersonalMode == mode) && (cell.PersonalParameter == partitionIndex);
+}
+
+static size_t ListPartitions(const Cell& cell, uint8_t partitions[64], size_t count, uint32_t mode) noexcept
+{
+	size_t n = 0;
+
+	for (size_t partitionIndex = 0; partitionIndex < count; partitionIndex++)
+	{
+		if (!IsPersonal(cell, partitionIndex, mode))
+		{
+			partitions[n++] = static_cast<uint8_t>(partitionIndex);
+		}
+	}
+
+	return n;
+}
+
+static size_t SelectPartitions(const Cell& cell, uint8_t partitions[64], const int estimations[64], size_t count, uint32_t mode) noexcept
+{
+	Node order[64];
+
+	size_t n = 0;
+
+	for (size_t partitionIndex = 0; partitionIndex < count; partitionIndex++)
+	{
+		if (!IsPersonal(cell, partitionIndex, mode))
+		{
+			order[n++].Init(estimations[partitionIndex], static_cast<int>(partitionIndex));
+		}
+	}
+
+	Node order2[64];
+	const Node* sorted = radix_sort(order, order2, n);
+
+	if (n > cell.PartitionsLimit)
+	{
+		n = cell.PartitionsLimit;
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		partitions[i] = static_cast<uint8_t>(sorted[i].Color);
+	}
+
+	return n;
+}
+
+static INLINED bool IsPersonalRotation(const Cell& cell, int rotation, uint32_t mode) noexcept
+{
+	return (cell.PersonalMode == mode) && !((cell.PersonalParameter ^ static_cast<uint64_t>(rotation)) & 3);
+}
+
+// Channel a rotation keeps apart, A,G,R,B
+static ALWAYS_INLINED int GetRotationChannel(int rotation) noexcept
+{
+	constexpr int channels = 0 | (2 << 2) | (1 << 4) | (3 << 6);
+
+	return (channels >> ((rotation & 3) << 1)) & 3;
+}
+
+// Weighted covariances of the active pixels times their count squared
+static ALWAYS_INLINED void ComputeAreaCovariances(const Area& area, float cov[4][4]) noexcept
+{
+	__m128i msum = _mm_setzero_si128();
+	__m128i msum2 = _mm_setzero_si128();
+	__m128i msumA = _mm_setzero_si128();
+	__m128i msumD = _mm_setzero_si128();
+
+	for (size_t i = 0, n = area.Active; i < n; i++)
+	{
+		__m128i mpixel = _mm_cvtepu16_epi32(_mm_load_si128(&area.DataMask_I16[i]));
+
+		msum = _mm_add_epi32(msum, mpixel);
+		msum2 = _mm_add_epi32(msum2, _mm_mullo_epi16(mpixel, _mm_shuffle_epi32(mpixel, _MM_SHUFFLE(1, 3, 2, 0))));
+		msumA = _mm_add_epi32(msumA, _mm_mullo_epi16(mpixel, _mm_shuffle_epi32(mpixel, 0)));
+		msumD = _mm_add_epi32(msumD, _mm_mullo_epi16(mpixel, mpixel));
+	}
+
+	const __m128i mactive = _mm_set1_epi32(static_cast<int>(area.Active));
+
+	msum2 = _mm_sub_epi32(_mm_mullo_epi32(msum2, mactive), _mm_mullo_epi32(msum, _mm_shuffle_epi32(msum, _MM_SHUFFLE(1, 3, 2, 0))));
+	msumA = _mm_sub_epi32(_mm_mullo_epi32(msumA, mactive), _mm_mullo_epi32(msum, _mm_shuffle_epi32(msum, 0)));
+	msumD = _mm_sub_epi32(_mm_mullo_epi32(msumD, mactive), _mm_mullo_epi32(msum, msum));
+
+	alignas(16) int covA[4], covD[4], covX[4];
+	_mm_store_si128((__m128i*)covA, msumA);
+	_mm_store_si128((__m128i*)covD, msumD);
+	_mm_store_si128((__m128i*)covX, msum2);
+
+	for (int c = 0; c < 4; c++)
+	{
+		cov[c][c] = static_cast<float>(covD[c]) * gRankWeights[c][c];
+
+		if (c > 0)
+		{
+			cov[0][c] = cov[c][0] = static_cast<float>(covA[c]) * gRankWeights[0][c];
+		}
+	}
+
+	cov[1][2] = cov[2][1] = static_cast<float>(covX[1]) * gRankWeights[1][2];
+	cov[2][3] = cov[3][2] = static_cast<float>(covX[2]) * gRankWeights[2][3];
+	cov[3][1] = cov[1][3] = static_cast<float>(covX[3]) * gRankWeights[3][1];
+}
+
+// Line error of the channels a rotation leaves together, their spread along the line and the spread of the channel apart
+static void EstimateRotations(const Area& area, float errors[4], float lines[4], float spreads[4]) noexcept
+{
+	float cov[4][4];
+	ComputeAreaCovariances(area, cov);
+
+	for (int s = 0; s < 4; s++)
+	{
+		float trace = 0, v[4];
+
+		for (int c = 0; c < 4; c++)
+		{
+			v[c] = 0;
+
+			if (c == s)
+				continue;
+
+			trace += cov[c][c];
+
+			for (int d = 0; d < 4; d++)
+			{
+				if (d != s)
+				{
+					v[c] += cov[c][d];
+				}
+			}
+		}
+
+		float num = 0, den = 0;
+
+		for (int c = 0; c < 4; c++)
+		{
+			if (c == s)
+				continue;
+
+			float u = 0;
+
+			for (int d = 0; d < 4; d++)
+			{
+				if (d != s)
+				{
+					u += cov[c][d] * v[d];
+				}
+			}
+
+			num += u * v[c];
+			den += v[c] * v[c];
+		}
+
+		const float lambda = num / ((den > 1.0f) ? den : 1.0f);
+
+		errors[s] = (trace > lambda) ? trace - lambda : 0.0f;
+		lines[s] = lambda;
+		spreads[s] = cov[s][s];
+	}
+}
+
+size_t RankRotations(const Cell& cell, int rotations[8], uint32_t mode) noexcept
+{
+	const int* list = (mode == 4) ? gRotationsMode4 : gRotationsMode5;
+	const size_t count = (mode == 4) ? 8 : 4;
+
+	if (cell.RotationsLimit >= count)
+	{
+		size_t n = 0;
+
+		for (size_t rotationIndex = 0; rotationIndex < count; rotationIndex++)
+		{
+			const int rotation = list[rotationIndex];
+
+			if (!IsPersonalRotation(cell, rotation, mode))
+			{
+				rotations[n++] = rotation;
+			}
+		}
+
+		return n;
+	}
+
+	float errors[4], lines[4], spreads[4];
+	EstimateRotations(cell.Area1, errors, lines, spreads);
+
+	float estimations[8];
+
+	size_t n = 0;
+
+	for (size_t rotationIndex = 0; rotationIndex < count; rotationIndex++)
+	{
+		const int rotation = list[rotationIndex];
+
+		if (IsPersonalRotation(cell, rotation, mode))
+			continue;
+
+		const int s = GetRotationChannel(rotation);
+
+		// Interpolation leaves about a spread over the squared index steps, 3 for 2-bit and 7 for 3-bit indices.
+		// Mode 4 gives 3-bit indices to the channel apart in index mode 0, else to the rest; mode 5 has 2-bit ones
+		const bool apart3 = (mode == 4) && !(rotation & 4);
+		const bool together3 = (mode == 4) && (rotation & 4);
+
+		const float estimation = errors[s] +
+			lines[s] * (together3 ? 1.0f / 49 : 1.0f / 9) +
+			spreads[s] * (apart3 ? 1.0f / 49 : 1.0f / 9);
+
+		// Insertion keeps the table order of equal estimations
+		size_t k = n++;
+		for (; (k > 0) && (estimations[k - 1] > estimation); k--)
+		{
+			estimations[k] = estimations[k - 1];
+			rotations[k] = rotations[k - 1];
+		}
+
+		estimations[k] = estimation;
+		rotations[k] = rotation;
+	}
+
+	if (n > cell.RotationsLimit)
+	{
+		n = cell.RotationsLimit;
+	}
+
+	return n;
+}
+
+size_t RankPartitions2(const Cell& cell, uint8_t partitions[64], bool alpha, uint32_t mode) noexcept
+{
+	if (cell.PartitionsLimit >= 64)
+		return ListPartitions(cell, partitions, 64, mode);
+
+	alignas(16) int estimations[64];
+
+	if (alpha)
+	{
+		EstimatePartitions2<0>(cell, estimations);
+	}
+	else
+	{
+		EstimatePartitions2<1>(cell, estimations);
+	}
+
+	return SelectPartitions(cell, partitions, estimations, 64, mode);
+}
+
+size_t RankPartitions3(const Cell& cell, uint8_t partitions[64], size_t count, uint32_t mode) noexcept
+{
+	if (cell.PartitionsLimit >= count)
+		return ListPartitions(cell, partitions, count, mode);
+
+	alignas(16) int estimations[64];
+
+	EstimatePartitions3(cell, estimations, count);
+
+	return SelectPartitions(cell, partitions, estimations, count, mode);
+}
+
+CORE_NAMESPACE_END
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "pch.h"
+#include "Bc7Core.h"
+
+CORE_NAMESPACE_BEGIN
+
+// Partitions for the full search of a mode, all but the one CompressBestMode refined already,
+// or the cell.PartitionsLimit best of them by line errors estimated from the moments of the pixels
+size_t RankPartitions2(const Cell& cell, uint8_t partitions[64], bool alpha, uint32_t mode) noexcept;
+size_t RankPartitions3(const Cell& cell, uint8_t partitions[64], size_t count, uint32_t mode) noexcept;
+
+// Rotations for the full search of mode 4 or 5, all but the one CompressBestMode refined already,
+// or the cell.RotationsLimit best of them by errors estimated from the covariances of the pixels.
+// Mode 4 lists both index modes of a rotation
+size_t RankRotations(const Cell& cell, int rotations[8], uint32_t mode) noexcept;
+
+void InitRank() noexcept;
+
+CORE_NAMESPACE_END
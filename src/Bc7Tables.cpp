@@ -1,6 +1,16 @@
 
 #include "pch.h"
 #include "Bc7Tables.h"
+#include "Numa.h"
+#include "FileMapping.h"
+#include "Worker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+CORE_NAMESPACE_BEGIN
 
 // https://www.khronos.org/registry/OpenGL/extensions/ARB/ARB_texture_compression_bptc.txt
 
@@ -368,6 +378,37 @@ void InitShrinked() noexcept
 }
 
 
+alignas(64) uint16_t gTableSolid2_Value7[0x100];
+
+void InitSolid() noexcept
+{
+	bool found[0x100] = {};
+
+	// Closest endpoint pairs first
+	for (int distance = 0; distance < 0x80; distance++)
+	{
+		for (int a = 0; a + distance < 0x80; a++)
+		{
+			for (int k = 0; k < 2; k++)
+			{
+				int c0 = (k == 0) ? a : a + distance;
+				int c1 = (k == 0) ? a + distance : a;
+
+				c0 = (c0 << 1) | (c0 >> 6);
+				c1 = (c1 << 1) | (c1 >> 6);
+
+				const int v = ((64 - 21) * c0 + 21 * c1 + 32) >> 6;
+				if (!found[v])
+				{
+					found[v] = true;
+
+					gTableSolid2_Value7[v] = static_cast<uint16_t>(c0 | (c1 << 8));
+				}
+			}
+		}
+	}
+}
+
 alignas(32) uint64_t gTableSelection12[64];
 alignas(32) uint64_t gTableSelection22[64];
 
@@ -476,57 +517,248 @@ void InitSelection() noexcept
 }
 
 
-alignas(64) uint8_t gTableDeltas2_Value8[0x100][0x100 * 0x100];
-alignas(64) uint8_t gTableDeltas2_Value7[0x100][0x80 * 0x80];
-alignas(64) uint8_t gTableDeltas2_Value6[0x100][0x40 * 0x40];
-alignas(64) uint8_t gTableDeltas2_Value5[0x100][0x20 * 0x20];
+static LevelTables gLevelTablesMain;
+static PageKind gLevelTablesPages = PageKind::Small;
+
+static LevelTables gLevelTablesNodes[64];
+static int gLevelTablesNodeCount = 0;
+
+// Rows x built so far, 1 for draft and 0x100 for full searches
+static size_t gLevelTablesRows = 0;
+
+thread_local const LevelTables* gLevelTables = &gLevelTablesMain;
+
+template<typename T>
+static INLINED void PlaceLevelTable(T*& table, uint8_t*& p, size_t rows)
+{
+	table = reinterpret_cast<T*>(p);
+
+	p += rows * sizeof(T);
+}
+
+static size_t PlaceLevelTables(LevelTables& tables, uint8_t* base, size_t rows)
+{
+	uint8_t* p = base;
+
+	PlaceLevelTable(tables.Deltas2_Value8, p, rows);
+	PlaceLevelTable(tables.Deltas2_Value7, p, rows);
+	PlaceLevelTable(tables.Deltas2_Value6, p, rows);
+	PlaceLevelTable(tables.Deltas2_Value5, p, rows);
+
+	PlaceLevelTable(tables.Cuts2_Value8, p, rows);
+	PlaceLevelTable(tables.Cuts2_Value6, p, rows);
+	PlaceLevelTable(tables.Cuts2_Value5, p, rows);
+
+	PlaceLevelTable(tables.Deltas3_Value6, p, rows);
+	PlaceLevelTable(tables.Deltas3_Value5, p, rows);
 
-alignas(64) uint16_t gTableCuts2_Value8[0x100][0x100];
-alignas(64) uint16_t gTableCuts2_Value6[0x100][0x40];
-alignas(64) uint16_t gTableCuts2_Value5[0x100][0x20];
+	PlaceLevelTable(tables.Cuts3_Value7Shared, p, rows);
+	PlaceLevelTable(tables.Cuts3_Value5, p, rows);
 
-alignas(64) uint8_t gTableDeltas3_Value7Shared[0x100][0x80 * 0x80];
-alignas(64) uint8_t gTableDeltas3_Value6[0x100][0x40 * 0x40];
-alignas(64) uint8_t gTableDeltas3_Value5[0x100][0x20 * 0x20];
+	PlaceLevelTable(tables.Deltas4Half_Value8, p, rows);
 
-alignas(64) uint16_t gTableCuts3_Value7Shared[0x100][0x80];
-alignas(64) uint16_t gTableCuts3_Value5[0x100][0x20];
+	PlaceLevelTable(tables.Deltas2Half_Value8, p, rows);
+	PlaceLevelTable(tables.Deltas2Half_Value6, p, rows);
+	PlaceLevelTable(tables.Deltas3Half_Value7Shared, p, rows);
 
-alignas(64) uint8_t gTableDeltas4Half_Value8[0x100][0x100 * 0x80];
+	return static_cast<size_t>(p - base);
+}
 
+static size_t LevelTablesSize(size_t rows) noexcept
+{
+	LevelTables tables;
+
+	return PlaceLevelTables(tables, nullptr, rows);
+}
+
+size_t LevelTablesSize() noexcept
+{
+	return LevelTablesSize(gLevelTablesRows);
+}
+
+// The draft block is too small for 2 MB pages
+static void* AllocateLevelTables(size_t rows, int node, PageKind& kind) noexcept
+{
+	if (rows < 0x100)
+	{
+		kind = PageKind::Small;
+		return NumaAllocate(LevelTablesSize(rows), node);
+	}
+
+	return NumaAllocateLarge(LevelTablesSize(rows), node, kind);
+}
+
+// Only the draft block is ever replaced, so it came from NumaAllocate
+static void FreeLevelTables() noexcept
+{
+	uint8_t* main = reinterpret_cast<uint8_t*>(gLevelTablesMain.Deltas2_Value8);
+	if (main == nullptr)
+		return;
+
+	const size_t size = LevelTablesSize();
+
+	for (int node = 0; node < gLevelTablesNodeCount; node++)
+	{
+		uint8_t* base = reinterpret_cast<uint8_t*>(gLevelTablesNodes[node].Deltas2_Value8);
+		if (base != main)
+		{
+			NumaFree(base, size);
+		}
+
+		gLevelTablesNodes[node] = LevelTables();
+	}
+	gLevelTablesNodeCount = 0;
+
+	NumaFree(main, size);
+
+	gLevelTablesMain = LevelTables();
+	gLevelTablesRows = 0;
+}
+
+// Reduced tables keep the endpoints c = (cH << 8) + cL that a bits-bit endpoint expands to
 template<int bits>
-static INLINED void ReduceLevels(const uint8_t table[0x100][0x100 * 0x100], uint8_t* p)
+static INLINED void MakeLevelEndpoints(uint8_t levels[0x100]) noexcept
 {
 	constexpr int step = 1 << (8 - bits);
 
-	for (int x = 0; x < 0x100; x++)
+	for (int k = 0; k < (1 << bits); k++)
 	{
-		for (int iH = 0; iH < 0x100; iH += step)
+		int i = k * step;
+
+		levels[k] = static_cast<uint8_t>(i + (i >> bits));
+	}
+}
+
+// All interpolated values for 16 endpoint pairs at once
+template<int count>
+static INLINED void InterpolateLevels(__m128i (&mv)[count], const short interpolate[count][2], __m128i mcL, __m128i mcH) noexcept
+{
+	const __m128i mhalf = _mm_set1_epi16(32);
+
+	const __m128i mc0 = _mm_unpacklo_epi8(mcL, mcH);
+	const __m128i mc1 = _mm_unpackhi_epi8(mcL, mcH);
+
+	for (int i = 0; i < count; i++)
+	{
+		const __m128i mratio = _mm_set1_epi16(static_cast<short>(interpolate[i][0] + (interpolate[i][1] << 8)));
+
+		__m128i mv0 = _mm_maddubs_epi16(mc0, mratio);
+		__m128i mv1 = _mm_maddubs_epi16(mc1, mratio);
+
+		mv0 = _mm_add_epi16(mv0, mhalf);
+		mv1 = _mm_add_epi16(mv1, mhalf);
+
+		mv0 = _mm_srli_epi16(mv0, 6);
+		mv1 = _mm_srli_epi16(mv1, 6);
+
+		mv[i] = _mm_packus_epi16(mv0, mv1);
+	}
+}
+
+// Denoised distance from x to the nearest interpolated value
+template<int count>
+static INLINED __m128i NearestLevels(const __m128i (&mv)[count], __m128i mx) noexcept
+{
+	__m128i md = _mm_or_si128(_mm_subs_epu8(mv[0], mx), _mm_subs_epu8(mx, mv[0]));
+
+	for (int i = 1; i < count; i++)
+	{
+		md = _mm_min_epu8(md, _mm_or_si128(_mm_subs_epu8(mv[i], mx), _mm_subs_epu8(mx, mv[i])));
+	}
+
+	md = _mm_srli_epi16(md, kDenoise);
+	md = _mm_and_si128(md, _mm_set1_epi8(static_cast<char>(0xFF >> kDenoise)));
+
+	return md;
+}
+
+// Endpoint pairs are interpolated once and reused by every row x of the slice
+template<int count, int bits>
+static INLINED void ComputeLevelRows(uint8_t* table, size_t row, size_t tile, const short interpolate[count][2], size_t begin, size_t end) noexcept
+{
+	constexpr size_t N = 1 << bits;
+
+	alignas(16) uint8_t levels[0x100];
+	MakeLevelEndpoints<bits>(levels);
+
+	for (size_t iH = 0; iH < N; iH++)
+	{
+		const __m128i mcH = _mm_set1_epi8(static_cast<char>(levels[iH]));
+
+		for (size_t iL = 0; iL < N; iL += 16)
+		{
+			__m128i mv[count];
+			InterpolateLevels<count>(mv, interpolate, _mm_load_si128((const __m128i*)&levels[iL]), mcH);
+
+			uint8_t* p = table + begin * row + LevelTileOffset(iH * N + iL, tile);
+
+			for (size_t x = begin; x < end; x++)
+			{
+				_mm_storeu_si128((__m128i*)p, NearestLevels<count>(mv, _mm_set1_epi8(static_cast<char>(x))));
+
+				p += row;
+			}
+		}
+	}
+}
+
+// Two deltas per byte, even c in the low nibble
+static INLINED void ComputeLevelRowsHalf(uint8_t* table, size_t row, size_t tile, size_t begin, size_t end) noexcept
+{
+	const __m128i miota = _mm_set_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	const __m128i mlimit = _mm_set1_epi8(0xF);
+	const __m128i mpack = _mm_set1_epi16(0x1001);
+
+	for (int cH = 0; cH < 0x100; cH++)
+	{
+		const __m128i mcH = _mm_set1_epi8(static_cast<char>(cH));
+
+		for (int cL = 0; cL < 0x100; cL += 32)
 		{
-			int cH = (iH + (iH >> bits)) << 8;
+			const __m128i mcL = _mm_add_epi8(_mm_set1_epi8(static_cast<char>(cL)), miota);
+
+			__m128i mv0[16], mv1[16];
+			InterpolateLevels<16>(mv0, gTableInterpolate4, mcL, mcH);
+			InterpolateLevels<16>(mv1, gTableInterpolate4, _mm_add_epi8(mcL, _mm_set1_epi8(16)), mcH);
 
-			for (int iL = 0; iL < 0x100; iL += step)
+			uint8_t* p = table + begin * row + LevelTileOffset(static_cast<size_t>((cH << 8) + cL) >> 1, tile);
+
+			for (size_t x = begin; x < end; x++)
 			{
-				int c = cH + iL + (iL >> bits);
+				const __m128i mx = _mm_set1_epi8(static_cast<char>(x));
+
+				__m128i md0 = _mm_min_epu8(NearestLevels<16>(mv0, mx), mlimit);
+				__m128i md1 = _mm_min_epu8(NearestLevels<16>(mv1, mx), mlimit);
+
+				md0 = _mm_maddubs_epi16(md0, mpack);
+				md1 = _mm_maddubs_epi16(md1, mpack);
+
+				_mm_storeu_si128((__m128i*)p, _mm_packus_epi16(md0, md1));
 
-				*p++ = table[x][c];
+				p += row;
 			}
 		}
 	}
 }
 
 template<int bits>
-static INLINED void FilterSharedLevels(uint8_t* p)
+static INLINED void FilterSharedLevels(uint8_t* p, size_t begin, size_t end) noexcept
 {
-	constexpr int N = 1 << bits;
+	constexpr size_t N = 1 << bits;
+
+	// Odd iL on even iH and even iL on odd iH
+	const __m128i modd = _mm_set1_epi16(static_cast<short>(0xFF00));
+	const __m128i meven = _mm_set1_epi16(0x00FF);
 
-	for (int x = 0; x < 0x100; x++)
+	for (size_t x = begin; x < end; x++)
 	{
-		for (int iH = 0; iH < N; iH++)
+		for (size_t iH = 0; iH < N; iH++)
 		{
-			for (int iL = (iH & 1) ^ 1; iL < N; iL += 2)
+			const __m128i mfill = (iH & 1) ? meven : modd;
+
+			for (size_t iL = 0; iL < N; iL += 16)
 			{
-				p[iL] = 0xFF;
+				_mm_storeu_si128((__m128i*)&p[iL], _mm_or_si128(_mm_loadu_si128((const __m128i*)&p[iL]), mfill));
 			}
 
 			p += N;
@@ -535,30 +767,31 @@ static INLINED void FilterSharedLevels(uint8_t* p)
 }
 
 template<int bits>
-static INLINED void CutLevels(const uint8_t table[0x100][1 << 2 * bits], uint16_t tower[0x100][1 << bits])
+static INLINED void CutLevels(const uint8_t* table, size_t row, size_t tile, uint16_t (*tower)[1 << bits], size_t begin, size_t end) noexcept
 {
 	constexpr int N = 1 << bits;
 
-	for (int x = 0; x < 0x100; x++)
+	for (size_t x = begin; x < end; x++)
 	{
 #if defined(OPTION_SELFCHECK)
 		uint16_t e = 0xFFFF;
 #endif
 
+		const uint8_t* values = table + x * row;
+
 		for (int iH = 0; iH < N; iH++)
 		{
-			int cH = iH << bits;
+			const size_t cH = static_cast<size_t>(iH << bits);
 
-			uint16_t cut = 0xFFFF;
-			for (int iL = 0, hL = iH | 31; iL <= hL; iL++)
+			// Spans are multiples of 32
+			__m128i mcut = _mm_set1_epi8(-1);
+			for (size_t iL = 0, hL = static_cast<size_t>(iH | 31); iL <= hL; iL += 16)
 			{
-				uint16_t value = table[x][cH + iL];
-
-				if (cut > value)
-				{
-					cut = value;
-				}
+				mcut = _mm_min_epu8(mcut, _mm_loadu_si128((const __m128i*)&values[LevelTileOffset(cH + iL, tile)]));
 			}
+			mcut = _mm_min_epu8(mcut, _mm_srli_epi16(mcut, 8));
+
+			uint16_t cut = static_cast<uint16_t>(_mm_extract_epi16(_mm_minpos_epu16(mcut), 0));
 			cut *= cut;
 
 			tower[x][iH] = cut;
@@ -580,172 +813,400 @@ static INLINED void CutLevels(const uint8_t table[0x100][1 << 2 * bits], uint16_
 	}
 }
 
-void InitLevels() noexcept
+// Same layout as Deltas4Half, but saturated from an existing table with rows of size bytes
+static INLINED void PackLevels(const uint8_t* src, size_t srcRow, size_t srcTile, uint8_t* dst, size_t dstRow, size_t dstTile, size_t size, size_t begin, size_t end) noexcept
 {
-	const __m128i mhalf = _mm_set1_epi16(32);
+	const __m128i mlimit = _mm_set1_epi8(0xF);
+	const __m128i mpack = _mm_set1_epi16(0x1001);
 
-	// 3-bit index
+	for (size_t x = begin; x < end; x++)
 	{
-		const auto gTableDeltas3_Value8 = gTableDeltas2_Value8;
+		const uint8_t* s = src + x * srcRow;
+		uint8_t* d = dst + x * dstRow;
 
-		__m128i mratio = _mm_setzero_si128();
+		for (size_t i = 0; i < size; i += 32)
 		{
-			__m128i m0 = gTableInterpolate3_U8[0];
-			__m128i m1 = gTableInterpolate3_U8[1];
-			__m128i m2 = gTableInterpolate3_U8[2];
-			__m128i m3 = gTableInterpolate3_U8[3];
-
-			mratio = _mm_blend_epi16(mratio, m0, 0x11);
-			mratio = _mm_blend_epi16(mratio, m1, 0x22);
-			mratio = _mm_blend_epi16(mratio, m2, 0x44);
-			mratio = _mm_blend_epi16(mratio, m3, 0x88);
-		}
+			const uint8_t* p = &s[LevelTileOffset(i, srcTile)];
 
-		for (int x = 0; x < 0x100; x++)
-		{
-			__m128i mx = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(x), 0), 0);
+			__m128i md0 = _mm_min_epu8(_mm_loadu_si128((const __m128i*)&p[0]), mlimit);
+			__m128i md1 = _mm_min_epu8(_mm_loadu_si128((const __m128i*)&p[16]), mlimit);
 
-			for (int cH = 0; cH < 0x100; cH++)
-			{
-				for (int cL = 0; cL < 0x100; cL++)
-				{
-					int c = (cH << 8) + cL;
+			md0 = _mm_maddubs_epi16(md0, mpack);
+			md1 = _mm_maddubs_epi16(md1, mpack);
 
-					__m128i mc = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(c), 0), 0);
+			_mm_storeu_si128((__m128i*)&d[LevelTileOffset(i >> 1, dstTile)], _mm_packus_epi16(md0, md1));
+		}
+	}
+}
 
-					__m128i mv = _mm_maddubs_epi16(mc, mratio);
-					mv = _mm_add_epi16(mv, mhalf);
-					mv = _mm_srli_epi16(mv, 6);
+// Each slice of rows x is independent
+static void ComputeLevelRange(void* context, size_t begin, size_t end) noexcept
+{
+	LevelTables& t = *static_cast<LevelTables*>(context);
 
-					mv = _mm_sub_epi16(mv, mx);
-					mv = _mm_abs_epi16(mv);
+	const size_t tile = t.TileStep();
 
-					mv = _mm_srli_epi16(mv, kDenoise);
+	// 3-bit index
+	for (size_t x = begin; x < end; x++)
+	{
+		// Only the cuts and the packed copy are kept, the single row has step 0
+		alignas(16) uint8_t shared[0x80 * 0x80];
 
-					gTableDeltas3_Value8[x][c] = (uint8_t)_mm_extract_epi16(_mm_minpos_epu16(mv), 0);
-				}
-			}
-		}
+		ComputeLevelRows<8, 7>(shared, 0, kLevelTile, gTableInterpolate3, x, x + 1); FilterSharedLevels<7>(shared, x, x + 1);
 
-		ReduceLevels<7>(gTableDeltas3_Value8, &gTableDeltas3_Value7Shared[0][0]); FilterSharedLevels<7>(&gTableDeltas3_Value7Shared[0][0]);
-		ReduceLevels<6>(gTableDeltas3_Value8, &gTableDeltas3_Value6[0][0]);
-		ReduceLevels<5>(gTableDeltas3_Value8, &gTableDeltas3_Value5[0][0]);
+		CutLevels<7>(shared, 0, kLevelTile, t.Cuts3_Value7Shared, x, x + 1);
 
-		CutLevels<7>(gTableDeltas3_Value7Shared, gTableCuts3_Value7Shared);
-		CutLevels<5>(gTableDeltas3_Value5, gTableCuts3_Value5);
+		PackLevels(shared, 0, kLevelTile, t.Deltas3Half_Value7Shared[0], t.RowStep(sizeof(t.Deltas3Half_Value7Shared[0])), tile, sizeof(shared), x, x + 1);
 	}
 
+	ComputeLevelRows<8, 6>(t.Deltas3_Value6[0], t.RowStep(sizeof(t.Deltas3_Value6[0])), tile, gTableInterpolate3, begin, end);
+	ComputeLevelRows<8, 5>(t.Deltas3_Value5[0], t.RowStep(sizeof(t.Deltas3_Value5[0])), tile, gTableInterpolate3, begin, end);
+
+	CutLevels<5>(t.Deltas3_Value5[0], t.RowStep(sizeof(t.Deltas3_Value5[0])), tile, t.Cuts3_Value5, begin, end);
+
 	// 2-bit index
+	ComputeLevelRows<4, 8>(t.Deltas2_Value8[0], t.RowStep(sizeof(t.Deltas2_Value8[0])), tile, gTableInterpolate2, begin, end);
+	ComputeLevelRows<4, 7>(t.Deltas2_Value7[0], t.RowStep(sizeof(t.Deltas2_Value7[0])), tile, gTableInterpolate2, begin, end);
+	ComputeLevelRows<4, 6>(t.Deltas2_Value6[0], t.RowStep(sizeof(t.Deltas2_Value6[0])), tile, gTableInterpolate2, begin, end);
+	ComputeLevelRows<4, 5>(t.Deltas2_Value5[0], t.RowStep(sizeof(t.Deltas2_Value5[0])), tile, gTableInterpolate2, begin, end);
+
+	CutLevels<8>(t.Deltas2_Value8[0], t.RowStep(sizeof(t.Deltas2_Value8[0])), tile, t.Cuts2_Value8, begin, end);
+	CutLevels<6>(t.Deltas2_Value6[0], t.RowStep(sizeof(t.Deltas2_Value6[0])), tile, t.Cuts2_Value6, begin, end);
+	CutLevels<5>(t.Deltas2_Value5[0], t.RowStep(sizeof(t.Deltas2_Value5[0])), tile, t.Cuts2_Value5, begin, end);
+
+	PackLevels(t.Deltas2_Value8[0], t.RowStep(sizeof(t.Deltas2_Value8[0])), tile, t.Deltas2Half_Value8[0], t.RowStep(sizeof(t.Deltas2Half_Value8[0])), tile, sizeof(t.Deltas2_Value8[0]), begin, end);
+	PackLevels(t.Deltas2_Value6[0], t.RowStep(sizeof(t.Deltas2_Value6[0])), tile, t.Deltas2Half_Value6[0], t.RowStep(sizeof(t.Deltas2Half_Value6[0])), tile, sizeof(t.Deltas2_Value6[0]), begin, end);
+
+	// 4-bit index
+	ComputeLevelRowsHalf(t.Deltas4Half_Value8[0], t.RowStep(sizeof(t.Deltas4Half_Value8[0])), tile, begin, end);
+}
+
+// Bump when generation changes
+constexpr uint32_t kLevelTablesVersion = 3;
+
+// Rows x per slice, interpolation is shared within a slice
+constexpr size_t kLevelTablesRows = 8;
+
+constexpr size_t kLevelTablesHeaderSize = 4096;
+
+struct LevelTablesHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	int32_t Denoise;
+	int32_t Weights[4];
+	int32_t Tiled;
+	uint64_t Size;
+	uint64_t Checksum;
+};
+
+static uint64_t ChecksumLevelTables(const uint8_t* p, size_t size) noexcept
+{
+	// Four independent lanes keep the multiplies pipelined
+	uint64_t h0 = 0x9E3779B97F4A7C15uLL, h1 = h0 + 1, h2 = h0 + 2, h3 = h0 + 3;
+
+	const uint64_t* w = reinterpret_cast<const uint64_t*>(p);
+
+	for (size_t i = 0, n = size >> 5; i < n; i++, w += 4)
 	{
-		__m128i mratio = _mm_setzero_si128();
+		h0 = (h0 ^ w[0]) * 0x100000001B3uLL;
+		h1 = (h1 ^ w[1]) * 0x100000001B3uLL;
+		h2 = (h2 ^ w[2]) * 0x100000001B3uLL;
+		h3 = (h3 ^ w[3]) * 0x100000001B3uLL;
+	}
+
+	return h0 ^ (h1 >> 1) ^ (h2 >> 2) ^ (h3 >> 3) ^ size;
+}
+
+static void MakeLevelTablesHeader(LevelTablesHeader& header, bool tiled, uint64_t checksum) noexcept
+{
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.Magic, "nebc7lvl", sizeof(header.Magic));
+	header.Version = kLevelTablesVersion;
+	header.Denoise = kDenoise;
+	header.Weights[0] = kAlpha;
+	header.Weights[1] = kGreen;
+	header.Weights[2] = kRed;
+	header.Weights[3] = kBlue;
+	header.Tiled = tiled;
+	header.Size = LevelTablesSize(0x100);
+	header.Checksum = checksum;
+}
+
+static bool GetLevelTablesCacheName(char* name, size_t size, bool tiled) noexcept
+{
+	const char* custom = getenv("NEBC7_TABLES");
+	if (custom != nullptr)
+	{
+		int n = snprintf(name, size, "%s", custom);
+
+		return (n > 0) && (static_cast<size_t>(n) < size);
+	}
+
+	char file[64];
+	snprintf(file, sizeof(file), "nebc7-levels-v%u-%s-d%d-%d-%d-%d-%d.bin",
+		kLevelTablesVersion, tiled ? "tiles" : "rows", static_cast<int>(kDenoise), static_cast<int>(kAlpha), static_cast<int>(kGreen), static_cast<int>(kRed), static_cast<int>(kBlue));
+
+	return GetCachePath(name, size, file);
+}
+
+static bool LoadLevelTables(const char* name, bool tiled) noexcept
+{
+	size_t size;
+	const uint8_t* view = static_cast<const uint8_t*>(MapFile(name, size));
+	if (view == nullptr)
+		return false;
+
+	const uint8_t* base = view + kLevelTablesHeaderSize;
+
+	if (size == kLevelTablesHeaderSize + LevelTablesSize(0x100))
+	{
+		uint64_t checksum;
+		memcpy(&checksum, view + offsetof(LevelTablesHeader, Checksum), sizeof(checksum));
+
+		LevelTablesHeader header;
+		MakeLevelTablesHeader(header, tiled, checksum);
+
+		// Header first, the hash reads the whole file
+		if ((memcmp(view, &header, sizeof(header)) == 0) && (ChecksumLevelTables(base, LevelTablesSize(0x100)) == checksum))
 		{
-			__m128i m0 = gTableInterpolate2_U8[0];
-			__m128i m1 = gTableInterpolate2_U8[1];
+			gLevelTablesMain.Tiled = tiled;
+
+			// Read-only, the kernels never write
+			PlaceLevelTables(gLevelTablesMain, const_cast<uint8_t*>(base), 0x100);
 
-			mratio = _mm_blend_epi16(mratio, m0, 0x11 + 0x44);
-			mratio = _mm_blend_epi16(mratio, m1, 0x22 + 0x88);
+			gLevelTablesPages = PageKind::Mapped;
+			gLevelTablesRows = 0x100;
+			return true;
 		}
+	}
 
-		for (int x = 0; x < 0x100; x++)
-		{
-			__m128i mx = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(x), 0), 0);
+	UnmapFile(view, size);
+	return false;
+}
 
-			for (int cH = 0; cH < 0x100; cH++)
-			{
-				for (int cL = 0; cL < 0x100; cL++)
-				{
-					int c = (cH << 8) + cL;
+static void SaveLevelTables(const char* name) noexcept
+{
+	const uint8_t* base = reinterpret_cast<const uint8_t*>(gLevelTablesMain.Deltas2_Value8);
+
+	alignas(8) uint8_t head[kLevelTablesHeaderSize] = {};
+	MakeLevelTablesHeader(*reinterpret_cast<LevelTablesHeader*>(head), gLevelTablesMain.Tiled, ChecksumLevelTables(base, LevelTablesSize(0x100)));
+
+	SaveFileAtomically(name, head, sizeof(head), base, LevelTablesSize(0x100));
+}
+
+// Pixel values of a block stay close, so a tile serves several of them from one cache line
+static NOTINLINED int ProbeLevelLayout(const uint8_t* table, size_t row, size_t tile, const uint8_t (*blocks)[17], size_t count) noexcept
+{
+	const __m128i mzero = _mm_setzero_si128();
 
-					__m128i mc = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(c), 0), 0);
+	__m128i msum = _mm_setzero_si128();
 
-					__m128i mv = _mm_maddubs_epi16(mc, mratio);
-					mv = _mm_add_epi16(mv, mhalf);
-					mv = _mm_srli_epi16(mv, 6);
+	for (size_t k = 0; k < count; k++)
+	{
+		const uint8_t* values[16];
 
-					mv = _mm_sub_epi16(mv, mx);
-					mv = _mm_abs_epi16(mv);
+		for (size_t i = 0; i < 16; i++)
+		{
+			values[i] = table + blocks[k][i] * row;
+		}
 
-					mv = _mm_srli_epi16(mv, kDenoise);
+		// Spans of cL for consecutive cH, as the searches walk them
+		for (size_t cH = blocks[k][16], hH = cH + 16; cH < hH; cH++)
+		{
+			for (size_t b = cH << 8, e = b + 0x80; b < e; b += 16)
+			{
+				const size_t at = LevelTileOffset(b, tile);
 
-					gTableDeltas2_Value8[x][c] = (uint8_t)_mm_extract_epi16(_mm_minpos_epu16(mv), 0);
+				for (size_t i = 0; i < 16; i++)
+				{
+					msum = _mm_add_epi64(msum, _mm_sad_epu8(_mm_load_si128((const __m128i*)&values[i][at]), mzero));
 				}
 			}
 		}
+	}
 
-		ReduceLevels<7>(gTableDeltas2_Value8, &gTableDeltas2_Value7[0][0]);
-		ReduceLevels<6>(gTableDeltas2_Value8, &gTableDeltas2_Value6[0][0]);
-		ReduceLevels<5>(gTableDeltas2_Value8, &gTableDeltas2_Value5[0][0]);
+	return _mm_cvtsi128_si32(msum);
+}
 
-		CutLevels<8>(gTableDeltas2_Value8, gTableCuts2_Value8);
-		CutLevels<6>(gTableDeltas2_Value6, gTableCuts2_Value6);
-		CutLevels<5>(gTableDeltas2_Value5, gTableCuts2_Value5);
-	}
+// NEBC7_LAYOUT=rows|tiles, otherwise the faster layout on a synthetic table of Deltas2Half_Value8 size
+static bool ChooseLevelLayout() noexcept
+{
+	const char* custom = getenv("NEBC7_LAYOUT");
+	if (custom != nullptr)
+		return strcmp(custom, "tiles") == 0;
 
-	// 4-bit index
+	constexpr size_t kRows = 0x100, kRow = 0x8000, kBlocks = 512;
+
+	uint8_t* table = static_cast<uint8_t*>(NumaAllocate(kRows * kRow, -1));
+	if (table == nullptr)
+		return false;
+
+	memset(table, 1, kRows * kRow);
+
+	static uint8_t blocks[kBlocks][17];
+
+	uint32_t seed = 1;
+	for (size_t k = 0; k < kBlocks; k++)
 	{
-		__m128i mratio0 = _mm_setzero_si128();
-		__m128i mratio1 = _mm_setzero_si128();
+		seed = seed * 1103515245u + 12345u;
+		const uint32_t base = (seed >> 16) % (0x100 - 32);
+
+		for (size_t i = 0; i < 16; i++)
 		{
-			__m128i m0 = gTableInterpolate4_U8[0];
-			__m128i m1 = gTableInterpolate4_U8[1];
-			__m128i m2 = gTableInterpolate4_U8[2];
-			__m128i m3 = gTableInterpolate4_U8[3];
-			__m128i m4 = gTableInterpolate4_U8[4];
-			__m128i m5 = gTableInterpolate4_U8[5];
-			__m128i m6 = gTableInterpolate4_U8[6];
-			__m128i m7 = gTableInterpolate4_U8[7];
-
-			mratio0 = _mm_blend_epi16(mratio0, m0, 0x11);
-			mratio0 = _mm_blend_epi16(mratio0, m1, 0x22);
-			mratio0 = _mm_blend_epi16(mratio0, m2, 0x44);
-			mratio0 = _mm_blend_epi16(mratio0, m3, 0x88);
-
-			mratio1 = _mm_blend_epi16(mratio1, m4, 0x11);
-			mratio1 = _mm_blend_epi16(mratio1, m5, 0x22);
-			mratio1 = _mm_blend_epi16(mratio1, m6, 0x44);
-			mratio1 = _mm_blend_epi16(mratio1, m7, 0x88);
+			seed = seed * 1103515245u + 12345u;
+			blocks[k][i] = static_cast<uint8_t>(base + ((seed >> 16) & 31));
 		}
 
-		for (int x = 0; x < 0x100; x++)
+		seed = seed * 1103515245u + 12345u;
+		blocks[k][16] = static_cast<uint8_t>((seed >> 16) % (kRow / 0x100 - 16));
+	}
+
+	int64_t best[2] = { INT64_MAX, INT64_MAX };
+	int check = 0;
+
+	for (int pass = 0; pass < 6; pass++)
+	{
+		const bool tiled = (pass & 1) != 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		check += ProbeLevelLayout(table, tiled ? kLevelTile : kRow, tiled ? kLevelTile * kRows : kLevelTile, blocks, kBlocks);
+
+		auto finish = std::chrono::steady_clock::now();
+
+		const int64_t span = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count());
+		if (best[tiled] > span)
 		{
-			__m128i mx = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(x), 0), 0);
+			best[tiled] = span;
+		}
+	}
 
-			for (int cH = 0; cH < 0x100; cH++)
-			{
-				for (int cL = 0; cL < 0x100; cL++)
-				{
-					int c = (cH << 8) + cL;
+	NumaFree(table, kRows * kRow);
+
+	// Rows unless tiles win clearly, they need no address arithmetic
+	return (check != 0) && (best[1] * 10 < best[0] * 9);
+}
+
+static void ComputeLevels(size_t rows, bool tiled) noexcept;
 
-					__m128i mc = _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_cvtsi32_si128(c), 0), 0);
+void InitLevels(bool full) noexcept
+{
+	const size_t rows = full ? 0x100 : 1;
+	if (gLevelTablesRows >= rows)
+		return;
 
-					__m128i mv0 = _mm_maddubs_epi16(mc, mratio0);
-					__m128i mv1 = _mm_maddubs_epi16(mc, mratio1);
+	FreeLevelTables();
 
-					mv0 = _mm_add_epi16(mv0, mhalf);
-					mv1 = _mm_add_epi16(mv1, mhalf);
+	// The draft block holds a single row, tiles would not help
+	if (!full)
+	{
+		ComputeLevels(rows, false);
+		return;
+	}
 
-					mv0 = _mm_srli_epi16(mv0, 6);
-					mv1 = _mm_srli_epi16(mv1, 6);
+	char name[4096];
 
-					mv0 = _mm_sub_epi16(mv0, mx);
-					mv1 = _mm_sub_epi16(mv1, mx);
+	// Whichever layout an earlier run picked, the probe is noisy and would split the cache in two
+	const char* layout = getenv("NEBC7_LAYOUT");
 
-					mv0 = _mm_abs_epi16(mv0);
-					mv1 = _mm_abs_epi16(mv1);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const bool tiled = (pass != 0);
 
-					__m128i mv = _mm_min_epi16(mv0, mv1);
+		if ((layout != nullptr) && ((strcmp(layout, "tiles") == 0) != tiled))
+			continue;
 
-					mv = _mm_srli_epi16(mv, kDenoise);
+		if (GetLevelTablesCacheName(name, sizeof(name), tiled) && name[0] && LoadLevelTables(name, tiled))
+			return;
+	}
 
-					mv = _mm_min_epi16(mv, _mm_set1_epi16(0xF));
+	const bool tiled = ChooseLevelLayout();
 
-					gTableDeltas4Half_Value8[x][c >> 1] |= static_cast<uint8_t>(_mm_extract_epi16(_mm_minpos_epu16(mv), 0) << ((c & 1) << 2));
-				}
-			}
-		}
+	const bool cached = GetLevelTablesCacheName(name, sizeof(name), tiled) && name[0];
+
+	ComputeLevels(rows, tiled);
+
+	if (cached && (gLevelTablesMain.Deltas2_Value8 != nullptr))
+	{
+		SaveLevelTables(name);
+	}
+}
+
+static void ComputeLevels(size_t rows, bool tiled) noexcept
+{
+	// Home node of the main copy, the other nodes get replicas
+	uint8_t* base = static_cast<uint8_t*>(AllocateLevelTables(rows, NumaCurrentNode(), gLevelTablesPages));
+	if (base == nullptr)
+	{
+		__debugbreak();
+		return;
 	}
+
+	LevelTables& t = gLevelTablesMain;
+
+	PlaceLevelTables(t, base, rows);
+
+	t.Tiled = tiled;
+
+	ProcessRange(rows, kLevelTablesRows, ComputeLevelRange, &t);
+
+	gLevelTablesRows = rows;
+}
+
+
+void InitLevelReplicas() noexcept
+{
+	const int count = NumaNodeCount();
+	if ((count <= 1) || (count > 64) || (gLevelTablesMain.Deltas2_Value8 == nullptr))
+		return;
+
+	const size_t size = LevelTablesSize();
+
+	const uint8_t* main = reinterpret_cast<const uint8_t*>(gLevelTablesMain.Deltas2_Value8);
+
+	const int home = NumaCurrentNode();
+
+	for (int node = 0; node < count; node++)
+	{
+		gLevelTablesNodes[node] = gLevelTablesMain;
+
+		if (node == home)
+			continue;
+
+		PageKind pages;
+		uint8_t* base = static_cast<uint8_t*>(AllocateLevelTables(gLevelTablesRows, node, pages));
+		if (base == nullptr)
+			continue;
+
+		memcpy(base, main, size);
+
+		PlaceLevelTables(gLevelTablesNodes[node], base, gLevelTablesRows);
+	}
+
+	gLevelTablesNodeCount = count;
+}
+
+PageKind LevelTablesPages() noexcept
+{
+	return gLevelTablesPages;
+}
+
+bool LevelTablesTiled() noexcept
+{
+	return gLevelTablesMain.Tiled;
 }
 
+void SelectLevelTables() noexcept
+{
+	if (gLevelTablesNodeCount > 1)
+	{
+		int node = NumaCurrentNode();
+
+		gLevelTables = &gLevelTablesNodes[(node < gLevelTablesNodeCount) ? node : 0];
+	}
+}
 
 alignas(16) const __m128i gWeightsAGRB = _mm_set_epi16(kBlue, kRed, kGreen, kAlpha, kBlue, kRed, kGreen, kAlpha);
 alignas(16) const __m128i gWeightsAGR = _mm_set_epi16(0, kRed, kGreen, kAlpha, 0, kRed, kGreen, kAlpha);
@@ -761,3 +1222,5 @@ alignas(16) const __m128i gWeightsGBGB = _mm_set_epi16(kBlue, kGreen, kBlue, kGr
 
 alignas(32) const int gRotationsMode4[8] = { 0 + 4, 0, 2 + 4, 2, 1 + 4, 1, 3 + 4, 3 };
 alignas(16) const int gRotationsMode5[4] = { 0, 2, 1, 3 };
+
+CORE_NAMESPACE_END
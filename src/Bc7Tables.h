@@ -1,6 +1,9 @@
 #pragma once
 
 #include "pch.h"
+#include "Numa.h"
+
+CORE_NAMESPACE_BEGIN
 
 alignas(32) extern __m128i gTableInterpolate2_U8[4 >> 1];
 alignas(64) extern __m128i gTableInterpolate3_U8[8 >> 1];
@@ -24,6 +27,12 @@ alignas(32) extern uint8_t gTableShrinkedHigh3[64];
 void InitShrinked() noexcept;
 
 
+// Mode 5 color endpoints that give the value at index 1 exactly, expanded to 8 bits: low byte first, high byte second
+alignas(64) extern uint16_t gTableSolid2_Value7[0x100];
+
+void InitSolid() noexcept;
+
+
 constexpr uint64_t gTableSelection11 = 0xFEDCBA9876543210uLL;
 
 alignas(32) extern uint64_t gTableSelection12[64];
@@ -36,25 +45,89 @@ alignas(32) extern uint64_t gTableSelection33[64];
 void InitSelection() noexcept;
 
 
-alignas(64) extern uint8_t gTableDeltas2_Value8[0x100][0x100 * 0x100];
-alignas(64) extern uint8_t gTableDeltas2_Value7[0x100][0x80 * 0x80];
-alignas(64) extern uint8_t gTableDeltas2_Value6[0x100][0x40 * 0x40];
-alignas(64) extern uint8_t gTableDeltas2_Value5[0x100][0x20 * 0x20];
+// Width of a tile in bytes, tiled tables keep it for all rows x together, so nearby pixel values share cache lines
+constexpr size_t kLevelTile = 32;
+
+// One contiguous block, replicated per NUMA node
+struct LevelTables
+{
+	uint8_t(*Deltas2_Value8)[0x100 * 0x100];
+	uint8_t(*Deltas2_Value7)[0x80 * 0x80];
+	uint8_t(*Deltas2_Value6)[0x40 * 0x40];
+	uint8_t(*Deltas2_Value5)[0x20 * 0x20];
+
+	uint16_t(*Cuts2_Value8)[0x100];
+	uint16_t(*Cuts2_Value6)[0x40];
+	uint16_t(*Cuts2_Value5)[0x20];
+
+	uint8_t(*Deltas3_Value6)[0x40 * 0x40];
+	uint8_t(*Deltas3_Value5)[0x20 * 0x20];
+
+	uint16_t(*Cuts3_Value7Shared)[0x80];
+	uint16_t(*Cuts3_Value5)[0x20];
+
+	uint8_t(*Deltas4Half_Value8)[0x100 * 0x80];
+
+	// Saturated to 15, two per byte, for the bandwidth-bound modes 1, 3 and 7
+	uint8_t(*Deltas2Half_Value8)[0x100 * 0x80];
+	uint8_t(*Deltas2Half_Value6)[0x40 * 0x20];
+	uint8_t(*Deltas3Half_Value7Shared)[0x80 * 0x40];
+
+	// Deltas only, the cuts always keep rows
+	bool Tiled = false;
 
-alignas(64) extern uint16_t gTableCuts2_Value8[0x100][0x100];
-alignas(64) extern uint16_t gTableCuts2_Value6[0x100][0x40];
-alignas(64) extern uint16_t gTableCuts2_Value5[0x100][0x20];
+	// Byte b of row x is at x * RowStep(sizeof(row)) + LevelTileOffset(b, TileStep())
+	ALWAYS_INLINED size_t RowStep(size_t size) const noexcept
+	{
+		return Tiled ? kLevelTile : size;
+	}
 
-alignas(64) extern uint8_t gTableDeltas3_Value7Shared[0x100][0x80 * 0x80];
-alignas(64) extern uint8_t gTableDeltas3_Value6[0x100][0x40 * 0x40];
-alignas(64) extern uint8_t gTableDeltas3_Value5[0x100][0x20 * 0x20];
+	ALWAYS_INLINED size_t TileStep() const noexcept
+	{
+		return Tiled ? kLevelTile * 0x100 : kLevelTile;
+	}
+};
 
-alignas(64) extern uint16_t gTableCuts3_Value7Shared[0x100][0x80];
-alignas(64) extern uint16_t gTableCuts3_Value5[0x100][0x20];
+constexpr size_t LevelTileOffset(size_t b, size_t tile) noexcept
+{
+	return (b / kLevelTile) * tile + (b % kLevelTile);
+}
 
-alignas(64) extern uint8_t gTableDeltas4Half_Value8[0x100][0x100 * 0x80];
+// Node-local copy for the calling thread
+extern thread_local const LevelTables* gLevelTables;
 
-void InitLevels() noexcept;
+// Template arguments of the level kernels, resolved through gLevelTables
+constexpr auto gTableDeltas2_Value8 = &LevelTables::Deltas2_Value8;
+constexpr auto gTableDeltas2_Value7 = &LevelTables::Deltas2_Value7;
+constexpr auto gTableDeltas2_Value6 = &LevelTables::Deltas2_Value6;
+constexpr auto gTableDeltas2_Value5 = &LevelTables::Deltas2_Value5;
+
+constexpr auto gTableCuts2_Value8 = &LevelTables::Cuts2_Value8;
+constexpr auto gTableCuts2_Value6 = &LevelTables::Cuts2_Value6;
+constexpr auto gTableCuts2_Value5 = &LevelTables::Cuts2_Value5;
+
+constexpr auto gTableDeltas3_Value6 = &LevelTables::Deltas3_Value6;
+constexpr auto gTableDeltas3_Value5 = &LevelTables::Deltas3_Value5;
+
+constexpr auto gTableCuts3_Value7Shared = &LevelTables::Cuts3_Value7Shared;
+constexpr auto gTableCuts3_Value5 = &LevelTables::Cuts3_Value5;
+
+constexpr auto gTableDeltas4Half_Value8 = &LevelTables::Deltas4Half_Value8;
+
+constexpr auto gTableDeltas2Half_Value8 = &LevelTables::Deltas2Half_Value8;
+constexpr auto gTableDeltas2Half_Value6 = &LevelTables::Deltas2Half_Value6;
+constexpr auto gTableDeltas3Half_Value7Shared = &LevelTables::Deltas3Half_Value7Shared;
+
+// Row x = 0 only, or every row for full searches
+void InitLevels(bool full) noexcept;
+
+void InitLevelReplicas() noexcept;
+
+size_t LevelTablesSize() noexcept;
+PageKind LevelTablesPages() noexcept;
+bool LevelTablesTiled() noexcept;
+
+void SelectLevelTables() noexcept;
 
 
 alignas(16) extern const __m128i gWeightsAGRB, gWeightsAGR, gWeightsAGB, gWeightsAG, gWeightsAR, gWeightsAGAG, gWeightsARAR;
@@ -63,3 +136,5 @@ alignas(16) extern const __m128i gWeightsGRB, gWeightsGRGR, gWeightsGBGB;
 
 alignas(32) extern const int gRotationsMode4[8];
 alignas(16) extern const int gRotationsMode5[4];
+
+CORE_NAMESPACE_END
@@ -0,0 +1,227 @@
+#include "pch.h"
+#include "FileMapping.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(WIN32)
+
+const void* MapFile(const char* name, size_t& size) noexcept
+{
+	size = 0;
+
+	HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER length;
+	if (!GetFileSizeEx(file, &length) || (length.QuadPart <= 0))
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	CloseHandle(file);
+
+	if (mapping == nullptr)
+		return nullptr;
+
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	CloseHandle(mapping);
+
+	if (view != nullptr)
+	{
+		size = static_cast<size_t>(length.QuadPart);
+	}
+
+	return view;
+}
+
+void UnmapFile(const void* view, size_t size) noexcept
+{
+	(void)size;
+
+	if (view != nullptr)
+	{
+		UnmapViewOfFile(view);
+	}
+}
+
+bool SaveFileAtomically(const char* name, const void* head, size_t head_size, const void* data, size_t data_size) noexcept
+{
+	char temp[MAX_PATH + 32];
+
+	int n = snprintf(temp, sizeof(temp), "%s.%lu", name, GetCurrentProcessId());
+	if ((n <= 0) || (static_cast<size_t>(n) >= sizeof(temp)))
+		return false;
+
+	// Fails on a leftover instead of writing through it
+	FILE* f = fopen(temp, "wbx");
+	if (f == nullptr)
+		return false;
+
+	bool ok = (fwrite(head, 1, head_size, f) == head_size) && (fwrite(data, 1, data_size, f) == data_size);
+
+	ok &= (fclose(f) == 0);
+
+	if (ok)
+	{
+		ok = MoveFileExA(temp, name, MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+
+	if (!ok)
+	{
+		DeleteFileA(temp);
+	}
+
+	return ok;
+}
+
+bool GetCachePath(char* path, size_t size, const char* name) noexcept
+{
+	char folder[MAX_PATH + 1];
+
+	DWORD length = GetTempPathA(MAX_PATH + 1, folder);
+	if (!length || (length > MAX_PATH))
+		return false;
+
+	int n = snprintf(path, size, "%s%s", folder, name);
+
+	return (n > 0) && (static_cast<size_t>(n) < size);
+}
+
+#else
+
+const void* MapFile(const char* name, size_t& size) noexcept
+{
+	size = 0;
+
+	int fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	// Only a regular file of this user that nobody else can write
+	struct stat info;
+	if ((fstat(fd, &info) != 0) || !S_ISREG(info.st_mode) || (info.st_uid != geteuid()) || (info.st_mode & (S_IWGRP | S_IWOTH)) || (info.st_size <= 0))
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (view == MAP_FAILED)
+		return nullptr;
+
+	size = static_cast<size_t>(info.st_size);
+
+	return view;
+}
+
+void UnmapFile(const void* view, size_t size) noexcept
+{
+	if (view != nullptr)
+	{
+		munmap(const_cast<void*>(view), size);
+	}
+}
+
+bool SaveFileAtomically(const char* name, const void* head, size_t head_size, const void* data, size_t data_size) noexcept
+{
+	char temp[4096 + 32];
+
+	int n = snprintf(temp, sizeof(temp), "%s.XXXXXX", name);
+	if ((n <= 0) || (static_cast<size_t>(n) >= sizeof(temp)))
+		return false;
+
+	// Unique name, created exclusively with mode 0600
+	int fd = mkstemp(temp);
+	if (fd < 0)
+		return false;
+
+	FILE* f = fdopen(fd, "wb");
+	if (f == nullptr)
+	{
+		close(fd);
+		unlink(temp);
+		return false;
+	}
+
+	bool ok = (fwrite(head, 1, head_size, f) == head_size) && (fwrite(data, 1, data_size, f) == data_size);
+
+	ok &= (fclose(f) == 0);
+
+	if (ok)
+	{
+		ok = (rename(temp, name) == 0);
+	}
+
+	if (!ok)
+	{
+		unlink(temp);
+	}
+
+	return ok;
+}
+
+bool GetCachePath(char* path, size_t size, const char* name) noexcept
+{
+	char folder[4096];
+
+	int n;
+
+	const char* base = getenv("XDG_CACHE_HOME");
+	if ((base != nullptr) && base[0])
+	{
+		n = snprintf(folder, sizeof(folder), "%s", base);
+	}
+	else
+	{
+		base = getenv("HOME");
+		if ((base == nullptr) || !base[0])
+			return false;
+
+		n = snprintf(folder, sizeof(folder), "%s/.cache", base);
+	}
+
+	if ((n <= 0) || (static_cast<size_t>(n) >= sizeof(folder)))
+		return false;
+
+	// Usually exists already
+	mkdir(folder, 0700);
+
+	const size_t length = static_cast<size_t>(n);
+
+	n = snprintf(folder + length, sizeof(folder) - length, "/nebc7");
+	if ((n <= 0) || (length + static_cast<size_t>(n) >= sizeof(folder)))
+		return false;
+
+	// Private to this user, others could otherwise plant or swap files
+	if ((mkdir(folder, 0700) != 0) && (errno != EEXIST))
+		return false;
+
+	struct stat info;
+	if ((lstat(folder, &info) != 0) || !S_ISDIR(info.st_mode) || (info.st_uid != geteuid()) || (info.st_mode & (S_IRWXG | S_IRWXO)))
+		return false;
+
+	n = snprintf(path, size, "%s/%s", folder, name);
+
+	return (n > 0) && (static_cast<size_t>(n) < size);
+}
+
+#endif
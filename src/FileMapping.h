@@ -0,0 +1,13 @@
+#pragma once
+
+#include "pch.h"
+
+// Private read-only view of a whole file, the kernels never write it
+const void* MapFile(const char* name, size_t& size) noexcept;
+void UnmapFile(const void* view, size_t size) noexcept;
+
+// Writes a new temporary file and renames it over name, so readers never see a partial file
+bool SaveFileAtomically(const char* name, const void* head, size_t head_size, const void* data, size_t data_size) noexcept;
+
+// File in a cache folder private to the current user
+bool GetCachePath(char* path, size_t size, const char* name) noexcept;
@@ -3,6 +3,8 @@
 #include "Metrics.h"
 #include "SnippetHorizontalSum4.h"
 
+CORE_NAMESPACE_BEGIN
+
 BlockError CompareBlocks(const Cell& cell1, const Cell& cell2) noexcept
 {
 #if defined(OPTION_AVX2)
@@ -138,3 +140,44 @@ BlockSSIM CompareBlocksSSIM(const Cell& cell1, const Cell& cell2) noexcept
 
 	return BlockSSIM(_mm_cvtsd_f64(mssim_ga), ssim * (1.0 / kColor));
 }
+
+bool DetectGlitches(const Cell& input, const Cell& output) noexcept
+{
+	const __m128i msign = _mm_set1_epi8(-0x80);
+
+#if defined(OPTION_LINEAR)
+
+	const __m128i mstep = _mm_set1_epi8(16 - 129);
+
+#else
+
+	const __m128i mstep = _mm_set_epi8(
+		20 - 129, 16 - 129, 12 - 129, 16 - 129,
+		20 - 129, 16 - 129, 12 - 129, 16 - 129,
+		20 - 129, 16 - 129, 12 - 129, 16 - 129,
+		20 - 129, 16 - 129, 12 - 129, 16 - 129);
+
+#endif
+
+	__m128i me = _mm_setzero_si128();
+
+	for (int y = 0; y < 4; y++)
+	{
+		__m128i mc1 = input.ImageRows_U8[y];
+		__m128i mc2 = output.ImageRows_U8[y];
+
+		__m128i mmask = input.MaskRows_S8[y];
+
+		__m128i md = _mm_or_si128(_mm_subs_epu8(mc1, mc2), _mm_subs_epu8(mc2, mc1));
+		md = _mm_and_si128(md, mmask);
+
+		md = _mm_xor_si128(md, msign);
+		md = _mm_cmpgt_epi8(md, mstep);
+
+		me = _mm_or_si128(me, md);
+	}
+
+	return _mm_movemask_epi8(me) != 0;
+}
+
+CORE_NAMESPACE_END
@@ -3,6 +3,8 @@
 #include "pch.h"
 #include "Bc7Core.h"
 
+CORE_NAMESPACE_BEGIN
+
 constexpr double gSsim16k1L = (0.01 * 255 * 16) * (0.01 * 255 * 16);
 constexpr double gSsim16k2L = gSsim16k1L * 9;
 
@@ -48,3 +50,8 @@ constexpr double gSsim16k2L = gSsim16k1L * 9;
 BlockError CompareBlocks(const Cell& cell1, const Cell& cell2) noexcept;
 
 BlockSSIM CompareBlocksSSIM(const Cell& cell1, const Cell& cell2) noexcept;
+
+// Any visible channel off by more than a coarse step
+bool DetectGlitches(const Cell& input, const Cell& output) noexcept;
+
+CORE_NAMESPACE_END
@@ -0,0 +1,354 @@
+#include "pch.h"
+#include "Numa.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#else
+#include <stdlib.h>
+#endif
+
+#if defined(WIN32)
+
+int NumaNodeCount() noexcept
+{
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest))
+		return 1;
+
+	return static_cast<int>(highest) + 1;
+}
+
+int NumaCurrentNode() noexcept
+{
+	PROCESSOR_NUMBER number;
+	GetCurrentProcessorNumberEx(&number);
+
+	USHORT node = 0;
+	if (!GetNumaProcessorNodeEx(&number, &node))
+		return 0;
+
+	return node;
+}
+
+void* NumaAllocate(size_t size, int node) noexcept
+{
+	if (node < 0)
+		return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+	return VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, static_cast<DWORD>(node));
+}
+
+void NumaFree(void* p, size_t size) noexcept
+{
+	(void)size;
+
+	if (p != nullptr)
+	{
+		VirtualFree(p, 0, MEM_RELEASE);
+	}
+}
+
+static bool EnableLockMemoryPrivilege() noexcept
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	TOKEN_PRIVILEGES privileges{};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	bool ok = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+		(GetLastError() == ERROR_SUCCESS);
+
+	CloseHandle(token);
+
+	return ok;
+}
+
+void* NumaAllocateLarge(size_t size, int node, PageKind& kind) noexcept
+{
+	static const bool gsLockMemory = EnableLockMemoryPrivilege();
+
+	const size_t page = GetLargePageMinimum();
+	if (gsLockMemory && page)
+	{
+		const size_t rounded = (size + page - 1) & ~(page - 1);
+
+		void* p = (node < 0) ?
+			VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE) :
+			VirtualAllocExNuma(GetCurrentProcess(), nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, static_cast<DWORD>(node));
+		if (p != nullptr)
+		{
+			kind = PageKind::Large;
+			return p;
+		}
+	}
+
+	kind = PageKind::Small;
+	return NumaAllocate(size, node);
+}
+
+bool NumaPinThread(int node) noexcept
+{
+	GROUP_AFFINITY affinity{};
+	if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) || !affinity.Mask)
+		return false;
+
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+#elif defined(__linux__)
+
+// "0-3,8-11" formatted list from sysfs
+static bool ReadNodeList(const char* name, cpu_set_t* set, int& last) noexcept
+{
+	FILE* f = fopen(name, "r");
+	if (f == nullptr)
+		return false;
+
+	char line[1024];
+	bool ok = (fgets(line, sizeof(line), f) != nullptr);
+
+	fclose(f);
+
+	if (!ok)
+		return false;
+
+	last = -1;
+
+	for (const char* p = line; (*p >= '0') && (*p <= '9');)
+	{
+		int from = 0;
+		while ((*p >= '0') && (*p <= '9')) from = from * 10 + (*p++ - '0');
+
+		int to = from;
+		if (*p == '-')
+		{
+			p++;
+
+			to = 0;
+			while ((*p >= '0') && (*p <= '9')) to = to * 10 + (*p++ - '0');
+		}
+
+		for (int i = from; i <= to; i++)
+		{
+			if (set && (i < CPU_SETSIZE))
+			{
+				CPU_SET(i, set);
+			}
+		}
+
+		if (last < to)
+		{
+			last = to;
+		}
+
+		if (*p == ',')
+		{
+			p++;
+		}
+	}
+
+	return last >= 0;
+}
+
+int NumaNodeCount() noexcept
+{
+	int last;
+	if (!ReadNodeList("/sys/devices/system/node/online", nullptr, last))
+		return 1;
+
+	return last + 1;
+}
+
+int NumaCurrentNode() noexcept
+{
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+		return 0;
+
+	return static_cast<int>(node);
+}
+
+static void NumaBind(void* p, size_t size, int node) noexcept
+{
+	if ((node >= 0) && (node < 64))
+	{
+		// MPOL_PREFERRED, falls back to other nodes when this one is full
+		unsigned long mask = 1uL << node;
+		syscall(SYS_mbind, p, size, 1, &mask, sizeof(mask) * 8 + 1, 0);
+	}
+}
+
+void* NumaAllocate(size_t size, int node) noexcept
+{
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+
+	NumaBind(p, size, node);
+
+	return p;
+}
+
+void NumaFree(void* p, size_t size) noexcept
+{
+	if (p != nullptr)
+	{
+		munmap(p, size);
+	}
+}
+
+#if defined(MADV_HUGEPAGE)
+
+// madvise succeeds even with "never" selected, the kernel then keeps 4 KB pages
+static bool IsTransparentHugePageEnabled() noexcept
+{
+	FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (f == nullptr)
+		return false;
+
+	char line[256];
+	bool ok = (fgets(line, sizeof(line), f) != nullptr);
+
+	fclose(f);
+
+	return ok && ((strstr(line, "[always]") != nullptr) || (strstr(line, "[madvise]") != nullptr));
+}
+
+#endif
+
+void* NumaAllocateLarge(size_t size, int node, PageKind& kind) noexcept
+{
+	constexpr size_t page = 2 * 1024 * 1024;
+
+	const size_t rounded = (size + page - 1) & ~(page - 1);
+
+#if defined(MAP_HUGETLB)
+	// Reserved pool, see /proc/sys/vm/nr_hugepages
+	{
+		void* p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			NumaBind(p, rounded, node);
+
+			kind = PageKind::Large;
+			return p;
+		}
+	}
+#endif
+
+#if defined(MADV_HUGEPAGE)
+	// Transparent huge pages need an aligned range
+	if (IsTransparentHugePageEnabled())
+	{
+		uint8_t* p = static_cast<uint8_t*>(mmap(nullptr, rounded + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (p != MAP_FAILED)
+		{
+			uint8_t* aligned = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(p) + page - 1) & ~(page - 1));
+
+			if (aligned != p)
+			{
+				munmap(p, static_cast<size_t>(aligned - p));
+			}
+
+			size_t tail = static_cast<size_t>((p + rounded + page) - (aligned + rounded));
+			if (tail)
+			{
+				munmap(aligned + rounded, tail);
+			}
+
+			NumaBind(aligned, rounded, node);
+
+			kind = (madvise(aligned, rounded, MADV_HUGEPAGE) == 0) ? PageKind::Transparent : PageKind::Small;
+			return aligned;
+		}
+	}
+#endif
+
+	kind = PageKind::Small;
+	return NumaAllocate(size, node);
+}
+
+bool NumaPinThread(int node) noexcept
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/sys/devices/system/node/node%d/cpulist", node);
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	int last;
+	if (!ReadNodeList(name, &set, last))
+		return false;
+
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+int NumaNodeCount() noexcept
+{
+	return 1;
+}
+
+int NumaCurrentNode() noexcept
+{
+	return 0;
+}
+
+void* NumaAllocate(size_t size, int node) noexcept
+{
+	(void)node;
+
+	return calloc(1, size);
+}
+
+void NumaFree(void* p, size_t size) noexcept
+{
+	(void)size;
+
+	free(p);
+}
+
+void* NumaAllocateLarge(size_t size, int node, PageKind& kind) noexcept
+{
+	kind = PageKind::Small;
+	return NumaAllocate(size, node);
+}
+
+bool NumaPinThread(int node) noexcept
+{
+	(void)node;
+
+	return false;
+}
+
+#endif
+
+const char* PageKindName(PageKind kind) noexcept
+{
+	switch (kind)
+	{
+	case PageKind::Large:
+		return "2 MB pages";
+
+	case PageKind::Transparent:
+		return "transparent huge pages";
+
+	case PageKind::Mapped:
+		return "mapped cache file";
+
+	default:
+		return "4 KB pages";
+	}
+}
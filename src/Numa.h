@@ -0,0 +1,20 @@
+#pragma once
+
+#include "pch.h"
+
+int NumaNodeCount() noexcept;
+
+int NumaCurrentNode() noexcept;
+
+// Zeroed pages placed on the node, or anywhere for node < 0
+void* NumaAllocate(size_t size, int node) noexcept;
+void NumaFree(void* p, size_t size) noexcept;
+
+enum class PageKind { Small, Transparent, Large, Mapped };
+
+const char* PageKindName(PageKind kind) noexcept;
+
+// Same as NumaAllocate, but tries 2 MB pages first to spare TLB misses on big tables
+void* NumaAllocateLarge(size_t size, int node, PageKind& kind) noexcept;
+
+bool NumaPinThread(int node) noexcept;
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "pch.h"
+#include "Bc7Core.h"
+
+CORE_NAMESPACE_BEGIN
+
+#if defined(OPTION_AVX512)
+
+// Two words of every pixel as one dword, pixels 0-7 in both halves unless all 16 are loaded.
+// Pixels from area.Count on are stale and must be masked out
+template<int w0, int w1, bool all>
+static ALWAYS_INLINED __m512i LoadAreaPlane(const Area& area) noexcept
+{
+	constexpr int w = w0 | (w1 << 16);
+	constexpr int s = 0x80008;
+
+	const __m512i widx = _mm512_set_epi32(
+		w + 7 * s, w + 6 * s, w + 5 * s, w + 4 * s, w + 3 * s, w + 2 * s, w + 1 * s, w,
+		w + 7 * s, w + 6 * s, w + 5 * s, w + 4 * s, w + 3 * s, w + 2 * s, w + 1 * s, w);
+
+	const __m512i* p = (const __m512i*)area.DataMask_I16;
+
+	__m512i wlow = _mm512_permutex2var_epi16(_mm512_load_si512(&p[0]), widx, _mm512_load_si512(&p[1]));
+
+	if constexpr (all)
+	{
+		__m512i whigh = _mm512_permutex2var_epi16(_mm512_load_si512(&p[2]), widx, _mm512_load_si512(&p[3]));
+
+		wlow = _mm512_inserti64x4(wlow, _mm512_castsi512_si256(whigh), 1);
+	}
+
+	return wlow;
+}
+
+// Weighted squared distance of a plane to a level, kDenoise applied
+static ALWAYS_INLINED __m512i PlaneLevelError(__m512i wplane, __m512i wlevel, __m512i wweights) noexcept
+{
+	__m512i wx = _mm512_sub_epi16(wplane, wlevel);
+
+	wx = _mm512_abs_epi16(wx);
+
+	wx = _mm512_srli_epi16(wx, kDenoise);
+
+	wx = _mm512_mullo_epi16(wx, wx);
+
+	return _mm512_madd_epi16(wx, wweights);
+}
+
+// Broadcasts dword i of wt, or i and j to the halves
+static ALWAYS_INLINED __m512i PlaneLevel(__m512i wt, int i) noexcept
+{
+	return _mm512_permutexvar_epi32(_mm512_set1_epi32(i), wt);
+}
+
+static ALWAYS_INLINED __m512i PlaneLevel(__m512i wt, int i, int j) noexcept
+{
+	return _mm512_permutexvar_epi32(_mm512_mask_set1_epi32(_mm512_set1_epi32(i), 0xFF00, j), wt);
+}
+
+static ALWAYS_INLINED int SumAreaPixels(const Area& area, __m512i werror) noexcept
+{
+	return _mm512_mask_reduce_add_epi32(static_cast<__mmask16>((1u << area.Count) - 1u), werror);
+}
+
+// All pixels against one level at a time, two levels side by side for small areas.
+// Levels are the dwords of wt, two channels each
+template<int w0, int w1, int levels>
+static ALWAYS_INLINED int ComputePlaneError(const Area& area, const __m512i wt, const __m512i wweights) noexcept
+{
+	__m512i werror = _mm512_set1_epi32(kBlockMaximalColorError);
+
+	if (area.Count <= 8)
+	{
+		const __m512i wplane = LoadAreaPlane<w0, w1, false>(area);
+
+		for (int i = 0; i < levels; i += 2)
+		{
+			werror = _mm512_min_epi32(werror, PlaneLevelError(wplane, PlaneLevel(wt, i, i + 1), wweights));
+		}
+
+		werror = _mm512_min_epi32(werror, _mm512_shuffle_i64x2(werror, werror, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+	else
+	{
+		const __m512i wplane = LoadAreaPlane<w0, w1, true>(area);
+
+		for (int i = 0; i < levels; i++)
+		{
+			werror = _mm512_min_epi32(werror, PlaneLevelError(wplane, PlaneLevel(wt, i), wweights));
+		}
+	}
+
+	return SumAreaPixels(area, werror);
+}
+
+// Levels are the qwords of wt, A,G and R,B
+template<int levels>
+static ALWAYS_INLINED int ComputePlanesError(const Area& area, const __m512i wt, const __m128i mweights) noexcept
+{
+	const __m512i wweightsAG = _mm512_broadcastd_epi32(mweights);
+	const __m512i wweightsRB = _mm512_broadcastd_epi32(_mm_srli_si128(mweights, 4));
+
+	__m512i werror = _mm512_set1_epi32(kBlockMaximalColorError);
+
+	if (area.Count <= 8)
+	{
+		const __m512i wag = LoadAreaPlane<0, 1, false>(area);
+		const __m512i wrb = LoadAreaPlane<2, 3, false>(area);
+
+		for (int i = 0; i < levels; i += 2)
+		{
+			__m512i wx = PlaneLevelError(wag, PlaneLevel(wt, i + i, i + i + 2), wweightsAG);
+			__m512i wy = PlaneLevelError(wrb, PlaneLevel(wt, i + i + 1, i + i + 3), wweightsRB);
+
+			werror = _mm512_min_epi32(werror, _mm512_add_epi32(wx, wy));
+		}
+
+		werror = _mm512_min_epi32(werror, _mm512_shuffle_i64x2(werror, werror, _MM_SHUFFLE(1, 0, 3, 2)));
+	}
+	else
+	{
+		const __m512i wag = LoadAreaPlane<0, 1, true>(area);
+		const __m512i wrb = LoadAreaPlane<2, 3, true>(area);
+
+		for (int i = 0; i < levels; i++)
+		{
+			__m512i wx = PlaneLevelError(wag, PlaneLevel(wt, i + i), wweightsAG);
+			__m512i wy = PlaneLevelError(wrb, PlaneLevel(wt, i + i + 1), wweightsRB);
+
+			werror = _mm512_min_epi32(werror, _mm512_add_epi32(wx, wy));
+		}
+	}
+
+	return SumAreaPixels(area, werror);
+}
+
+#endif
+
+CORE_NAMESPACE_END
@@ -3,6 +3,9 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "SnippetAreaPlanes.h"
+
+CORE_NAMESPACE_BEGIN
 
 static INLINED int ComputeOpaqueSubsetError2(const Area& area, __m128i mc, const __m128i mwater) noexcept
 {
@@ -10,7 +13,24 @@ static INLINED int ComputeOpaqueSubsetError2(const Area& area, __m128i mc, const
 
 	const __m128i mweights = gWeightsGRB;
 
-#if defined(OPTION_AVX2)
+#if defined(OPTION_AVX512)
+	(void)mwater;
+
+	const __m256i vhalf = _mm256_set1_epi16(32);
+
+	mc = _mm_packus_epi16(mc, mc);
+	__m256i vc = _mm256_broadcastq_epi64(mc);
+
+	__m256i vt = *(const __m256i*)gTableInterpolate2_U8;
+
+	vt = _mm256_maddubs_epi16(vc, vt);
+
+	vt = _mm256_add_epi16(vt, vhalf);
+
+	vt = _mm256_srli_epi16(vt, 6);
+
+	merrorBlock = _mm_cvtsi32_si128(ComputePlanesError<4>(area, _mm512_castsi256_si512(vt), mweights));
+#elif defined(OPTION_AVX2)
 	const __m256i vweights = _mm256_broadcastq_epi64(mweights);
 
 	const __m256i vhalf = _mm256_set1_epi16(32);
@@ -197,7 +217,26 @@ static INLINED int ComputeOpaqueSubsetError2Pair(const Area& area, __m128i mc, c
 {
 	__m128i merrorBlock = _mm_setzero_si128();
 
-#if defined(OPTION_AVX2)
+#if defined(OPTION_AVX512)
+	(void)mwater;
+
+	const __m128i mhalf = _mm_set1_epi16(32);
+
+	mc = _mm_shuffle_epi32(mc, shuffle);
+	mc = _mm_packus_epi16(mc, mc);
+
+	__m128i mt = gTableInterpolate2GR_U8[0];
+
+	mt = _mm_maddubs_epi16(mc, mt);
+
+	mt = _mm_add_epi16(mt, mhalf);
+
+	mt = _mm_srli_epi16(mt, 6);
+
+	const __m512i wt = _mm512_castsi128_si512(mt);
+
+	merrorBlock = _mm_cvtsi32_si128(ComputePlaneError<shuffle & 3, (shuffle >> 2) & 3, 4>(area, wt, _mm512_broadcastd_epi32(mweights)));
+#elif defined(OPTION_AVX2)
 	const __m256i vweights = _mm256_broadcastq_epi64(mweights);
 
 	const __m256i vhalf = _mm256_set1_epi16(32);
@@ -383,3 +422,5 @@ static INLINED int ComputeOpaqueSubsetTable2(const Area& area, __m128i mc, uint6
 
 	return error;
 }
+
+CORE_NAMESPACE_END
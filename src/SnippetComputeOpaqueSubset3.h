@@ -3,6 +3,9 @@
 #include "pch.h"
 #include "Bc7Core.h"
 #include "Bc7Tables.h"
+#include "SnippetAreaPlanes.h"
+
+CORE_NAMESPACE_BEGIN
 
 static INLINED int ComputeOpaqueSubsetError3(const Area& area, __m128i mc, const __m128i mwater) noexcept
 {
@@ -11,7 +14,7 @@ static INLINED int ComputeOpaqueSubsetError3(const Area& area, __m128i mc, const
 	const __m128i mweights = gWeightsGRB;
 
 #if defined(OPTION_AVX512)
-	const __m512i wweights = _mm512_broadcastq_epi64(mweights);
+	(void)mwater;
 
 	const __m512i whalf = _mm512_set1_epi16(32);
 
@@ -26,72 +29,7 @@ static INLINED int ComputeOpaqueSubsetError3(const Area& area, __m128i mc, const
 
 	wt = _mm512_srli_epi16(wt, 6);
 
-	__m512i wtx = _mm512_permutex_epi64(wt, 0x44);
-	__m512i wty = _mm512_permutex_epi64(wt, 0xEE);
-
-	int k = static_cast<int>(area.Count);
-	const __m256i* p = (const __m256i*)area.DataMask_I16;
-
-	while ((k -= 2) >= 0)
-	{
-		__m256i vpacked = _mm256_load_si256(p);
-		__m256i vpixel = _mm256_unpacklo_epi64(vpacked, vpacked);
-		__m512i wpixel = _mm512_broadcast_i64x4(vpixel);
-
-		__m512i wx = _mm512_sub_epi16(wpixel, wtx);
-		__m512i wy = _mm512_sub_epi16(wpixel, wty);
-
-		wx = _mm512_abs_epi16(wx);
-		wy = _mm512_abs_epi16(wy);
-
-		wx = _mm512_srli_epi16(wx, kDenoise);
-		wy = _mm512_srli_epi16(wy, kDenoise);
-
-		wx = _mm512_mullo_epi16(wx, wx);
-		wy = _mm512_mullo_epi16(wy, wy);
-
-		wx = _mm512_madd_epi16(wx, wweights);
-		wy = _mm512_madd_epi16(wy, wweights);
-
-		wx = _mm512_add_epi32(wx, _mm512_shuffle_epi32(wx, _MM_SHUFFLE(2, 3, 0, 1)));
-		wy = _mm512_add_epi32(wy, _mm512_shuffle_epi32(wy, _MM_SHUFFLE(2, 3, 0, 1)));
-
-		wx = _mm512_min_epi32(wx, wy);
-		__m256i vx = _mm256_min_epi32(_mm512_extracti64x4_epi64(wx, 1), _mm512_castsi512_si256(wx));
-		vx = _mm256_min_epi32(vx, _mm256_shuffle_epi32(vx, _MM_SHUFFLE(1, 0, 3, 2)));
-
-		merrorBlock = _mm_add_epi32(merrorBlock, _mm256_castsi256_si128(vx));
-		merrorBlock = _mm_add_epi32(merrorBlock, _mm256_extracti128_si256(vx, 1));
-
-		p++;
-
-		if (!(_mm_movemask_epi8(_mm_cmpgt_epi32(mwater, merrorBlock)) & 0xF))
-			goto done;
-	}
-
-	if (k & 1)
-	{
-		__m128i mpacked = _mm_load_si128((const __m128i*)p);
-		__m512i wpixel = _mm512_broadcastq_epi64(mpacked);
-
-		__m512i wx = _mm512_sub_epi16(wpixel, wt);
-
-		wx = _mm512_abs_epi16(wx);
-
-		wx = _mm512_srli_epi16(wx, kDenoise);
-
-		wx = _mm512_mullo_epi16(wx, wx);
-
-		wx = _mm512_madd_epi16(wx, wweights);
-
-		wx = _mm512_add_epi32(wx, _mm512_shuffle_epi32(wx, _MM_SHUFFLE(2, 3, 0, 1)));
-
-		__m256i vx = _mm256_min_epi32(_mm512_extracti64x4_epi64(wx, 1), _mm512_castsi512_si256(wx));
-		vx = _mm256_min_epi32(vx, _mm256_shuffle_epi32(vx, _MM_SHUFFLE(1, 0, 3, 2)));
-
-		merrorBlock = _mm_add_epi32(merrorBlock, _mm_min_epi32(_mm256_extracti128_si256(vx, 1), _mm256_castsi256_si128(vx)));
-	}
-done:
+	merrorBlock = _mm_cvtsi32_si128(ComputePlanesError<8>(area, wt, mweights));
 #elif defined(OPTION_AVX2)
 	const __m256i vweights = _mm256_broadcastq_epi64(mweights);
 
@@ -274,7 +212,27 @@ static INLINED int ComputeOpaqueSubsetError3Pair(const Area& area, __m128i mc, c
 {
 	__m128i merrorBlock = _mm_setzero_si128();
 
-#if defined(OPTION_AVX2)
+#if defined(OPTION_AVX512)
+	(void)mwater;
+
+	const __m256i vhalf = _mm256_set1_epi16(32);
+
+	mc = _mm_shuffle_epi32(mc, shuffle);
+	mc = _mm_packus_epi16(mc, mc);
+	__m256i vc = _mm256_broadcastq_epi64(mc);
+
+	__m256i vt = *(const __m256i*)gTableInterpolate3GR_U8;
+
+	vt = _mm256_maddubs_epi16(vc, vt);
+
+	vt = _mm256_add_epi16(vt, vhalf);
+
+	vt = _mm256_srli_epi16(vt, 6);
+
+	const __m512i wt = _mm512_castsi256_si512(vt);
+
+	merrorBlock = _mm_cvtsi32_si128(ComputePlaneError<shuffle & 3, (shuffle >> 2) & 3, 8>(area, wt, _mm512_broadcastd_epi32(mweights)));
+#elif defined(OPTION_AVX2)
 	const __m256i vweights = _mm256_broadcastq_epi64(mweights);
 
 	const __m256i vhalf = _mm256_set1_epi16(32);
@@ -503,3 +461,5 @@ static INLINED int ComputeOpaqueSubsetTable3(const Area& area, __m128i mc, uint6
 
 	return error;
 }
+
+CORE_NAMESPACE_END
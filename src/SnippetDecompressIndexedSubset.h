@@ -3,6 +3,8 @@
 #include "pch.h"
 #include "Bc7Tables.h"
 
+CORE_NAMESPACE_BEGIN
+
 template<int bits>
 static INLINED void DecompressIndexedSubset(__m128i mc, uint64_t indices, int* output, uint64_t data) noexcept
 {
@@ -37,3 +39,5 @@ static INLINED void DecompressIndexedSubset(__m128i mc, uint64_t indices, int* o
 
 	} while (--count);
 }
+
+CORE_NAMESPACE_END
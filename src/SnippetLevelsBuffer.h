@@ -2,6 +2,10 @@
 
 #include "pch.h"
 #include "Bc7Core.h"
+#include "Bc7Tables.h"
+#include "SnippetLevelsUnique.h"
+
+CORE_NAMESPACE_BEGIN
 
 #if defined(OPTION_COUNTERS)
 inline std::atomic_int gEstimateFull, gEstimateShort;
@@ -39,11 +43,17 @@ public:
 		Err[0].Color = color;
 	}
 
-	template<int bits, int pbits, bool transparent, const uint8_t table[0x100][1 << 2 * (bits + int(pbits >= 0))], bool single = false>
+	template<int bits, int pbits, bool transparent, uint8_t(*LevelTables::*table)[1 << 2 * (bits + int(pbits >= 0))], bool single = false>
 	NOTINLINED void ComputeChannelLevelsReduced(const Area& area, const size_t offset, const int weight, const int water) noexcept
 	{
 		const uint8_t* values[16];
 
+		const LevelTables& tables = *gLevelTables;
+
+		const uint8_t* deltas = (tables.*table)[0];
+		const size_t row = tables.RowStep(sizeof((tables.*table)[0]));
+		const size_t tile = tables.TileStep();
+
 		size_t count;
 		if constexpr (transparent)
 		{
@@ -67,11 +77,14 @@ public:
 			count = area.Count;
 		}
 
-		for (size_t i = 0; i < count; i++)
-		{
-			size_t value = ((const uint16_t*)&area.DataMask_I16[i])[offset];
+		size_t unique[16];
+		__m128i weights[16];
+
+		const size_t n = GatherUniqueValues(area, offset, count, unique, weights);
 
-			values[i] = table[value];
+		for (size_t i = 0; i < n; i++)
+		{
+			values[i] = deltas + unique[i] * row;
 		}
 
 		int top = (water + weight - 1) / weight;
@@ -154,7 +167,14 @@ public:
 				int cH = (iH << shift);
 
 				int hL = (single ? Min(LH, iH) : LH) + cH;
-				Estimate32Step8Short(nodesPtr, values, count, cH, hL, mtop);
+				if (n < count)
+				{
+					Estimate32Step8Short<true>(nodesPtr, values, weights, n, tile, cH, hL, mtop);
+				}
+				else
+				{
+					Estimate32Step8Short<false>(nodesPtr, values, weights, n, tile, cH, hL, mtop);
+				}
 			}
 		}
 		else
@@ -169,7 +189,14 @@ public:
 				int cH = (iH << shift);
 
 				int hL = (single ? Min(LH, iH) : LH) + cH;
-				Estimate16PStep8Short(nodesPtr, values, count, cH, hL, mtop, pL);
+				if (n < count)
+				{
+					Estimate16PStep8Short<true>(nodesPtr, values, weights, n, tile, cH, hL, mtop, pL);
+				}
+				else
+				{
+					Estimate16PStep8Short<false>(nodesPtr, values, weights, n, tile, cH, hL, mtop, pL);
+				}
 			}
 		}
 
@@ -260,13 +287,16 @@ private:
 
 #if defined(OPTION_AVX512)
 
-	static INLINED void Estimate32Step8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop) noexcept
+	template<bool weighted>
+	static INLINED void Estimate32Step8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop) noexcept
 	{
 		const __m512i wwater = _mm512_broadcastw_epi16(mtop);
 
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 			__m512i wsum = _mm512_setzero_si512();
 			int tail = static_cast<int>(~0u >> Max(0, (c | 31) - (hL | 7)));
 			int flags = 0;
@@ -275,7 +305,7 @@ private:
 			{
 				auto value = values[i];
 
-				const __m256i* p = (const __m256i*)&value[c];
+				const __m256i* p = (const __m256i*)&value[at];
 
 				__m256i vdelta = _mm256_load_si256(p);
 
@@ -283,6 +313,11 @@ private:
 
 				wadd = _mm512_mullo_epi16(wadd, wadd);
 
+				if constexpr (weighted)
+				{
+					wadd = MultiplyWeightSaturated(wadd, weights[i]);
+				}
+
 				wsum = _mm512_adds_epu16(wsum, wadd);
 
 				flags = static_cast<int>(_mm512_cmp_epu16_mask(wwater, wsum, _MM_CMPINT_GT));
@@ -301,7 +336,8 @@ private:
 		} while (c <= hL);
 	}
 
-	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop, const int pL) noexcept
+	template<bool weighted>
+	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop, const int pL) noexcept
 	{
 		const __m256i vtop = _mm256_broadcastw_epi16(mtop);
 
@@ -316,13 +352,15 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 			__m256i vsum = _mm256_setzero_si256();
 
 			for (size_t i = 0; i < count; i++)
 			{
 				auto value = values[i];
 
-				const __m256i* p = (const __m256i*)&value[c];
+				const __m256i* p = (const __m256i*)&value[at];
 
 				__m256i vdelta = _mm256_load_si256(p);
 
@@ -330,6 +368,11 @@ private:
 
 				vadd = _mm256_mullo_epi16(vadd, vadd);
 
+				if constexpr (weighted)
+				{
+					vadd = MultiplyWeightSaturated(vadd, weights[i]);
+				}
+
 				vsum = _mm256_adds_epu16(vsum, vadd);
 			}
 
@@ -354,7 +397,8 @@ private:
 
 #elif defined(OPTION_AVX2)
 
-	static INLINED void Estimate32Step8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop) noexcept
+	template<bool weighted>
+	static INLINED void Estimate32Step8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop) noexcept
 	{
 		const __m256i vsign = _mm256_set1_epi16(-0x8000);
 		const __m256i vwater = _mm256_xor_si256(_mm256_broadcastw_epi16(mtop), vsign);
@@ -362,6 +406,8 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 			__m256i vsum = _mm256_setzero_si256();
 			int tail = static_cast<int>(~0u >> (Max(0, (c | 15) - (hL | 7)) << 1));
 			int flags = 0;
@@ -370,7 +416,7 @@ private:
 			{
 				auto value = values[i];
 
-				const __m128i* p = (const __m128i*)&value[c];
+				const __m128i* p = (const __m128i*)&value[at];
 
 				__m128i mdelta = _mm_load_si128(p);
 
@@ -378,6 +424,11 @@ private:
 
 				vadd = _mm256_mullo_epi16(vadd, vadd);
 
+				if constexpr (weighted)
+				{
+					vadd = MultiplyWeightSaturated(vadd, weights[i]);
+				}
+
 				vsum = _mm256_adds_epu16(vsum, vadd);
 
 				flags = _mm256_movemask_epi8(_mm256_cmpgt_epi16(vwater, _mm256_xor_si256(vsum, vsign)));
@@ -394,7 +445,8 @@ private:
 		} while (c <= hL);
 	}
 
-	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop, const int pL) noexcept
+	template<bool weighted>
+	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop, const int pL) noexcept
 	{
 		const __m256i vsign = _mm256_set1_epi16(-0x8000);
 		const __m256i vwater = _mm256_xor_si256(_mm256_broadcastw_epi16(mtop), vsign);
@@ -410,13 +462,15 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 			__m256i vsum = _mm256_setzero_si256();
 
 			for (size_t i = 0; i < count; i++)
 			{
 				auto value = values[i];
 
-				const __m256i* p = (const __m256i*)&value[c];
+				const __m256i* p = (const __m256i*)&value[at];
 
 				__m256i vdelta = _mm256_load_si256(p);
 
@@ -424,6 +478,11 @@ private:
 
 				vadd = _mm256_mullo_epi16(vadd, vadd);
 
+				if constexpr (weighted)
+				{
+					vadd = MultiplyWeightSaturated(vadd, weights[i]);
+				}
+
 				vsum = _mm256_adds_epu16(vsum, vadd);
 			}
 
@@ -448,7 +507,8 @@ private:
 
 #else
 
-	static INLINED void Estimate32Step8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop) noexcept
+	template<bool weighted>
+	static INLINED void Estimate32Step8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop) noexcept
 	{
 		const __m128i msign = _mm_set1_epi16(-0x8000);
 		const __m128i mwater = _mm_xor_si128(mtop, msign);
@@ -456,6 +516,8 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 			__m128i msum = _mm_setzero_si128();
 			int flags = 0;
 
@@ -463,7 +525,7 @@ private:
 			{
 				auto value = values[i];
 
-				const __m128i* p = (const __m128i*)&value[c];
+				const __m128i* p = (const __m128i*)&value[at];
 
 				__m128i mdelta = _mm_loadl_epi64(p);
 
@@ -471,6 +533,11 @@ private:
 
 				madd = _mm_mullo_epi16(madd, madd);
 
+				if constexpr (weighted)
+				{
+					madd = MultiplyWeightSaturated(madd, weights[i]);
+				}
+
 				msum = _mm_adds_epu16(msum, madd);
 
 				flags = _mm_movemask_epi8(_mm_cmpgt_epi16(mwater, _mm_xor_si128(msum, msign)));
@@ -498,7 +565,8 @@ private:
 		}
 	}
 
-	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop, const int pL) noexcept
+	template<bool weighted>
+	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop, const int pL) noexcept
 	{
 		const __m128i mwater = _mm_cvtepu16_epi32(mtop);
 
@@ -511,13 +579,15 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 			__m128i msum = _mm_setzero_si128();
 
 			for (size_t i = 0; i < count; i++)
 			{
 				auto value = values[i];
 
-				const __m128i* p = (const __m128i*)&value[c];
+				const __m128i* p = (const __m128i*)&value[at];
 
 				__m128i mdelta = _mm_loadl_epi64(p);
 
@@ -525,6 +595,12 @@ private:
 
 				madd = _mm_mullo_epi16(madd, madd);
 
+				if constexpr (weighted)
+				{
+					// Squares sit in 32-bit lanes, the products need no saturation
+					madd = _mm_madd_epi16(madd, weights[i]);
+				}
+
 				msum = _mm_add_epi32(msum, madd);
 			}
 
@@ -542,3 +618,5 @@ private:
 
 #endif
 };
+
+CORE_NAMESPACE_END
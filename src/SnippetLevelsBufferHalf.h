@@ -2,6 +2,10 @@
 
 #include "pch.h"
 #include "Bc7Core.h"
+#include "Bc7Tables.h"
+#include "SnippetLevelsUnique.h"
+
+CORE_NAMESPACE_BEGIN
 
 #if defined(OPTION_COUNTERS)
 inline std::atomic_int gEstimateHalf;
@@ -39,11 +43,17 @@ public:
 		Err[0].Color = color;
 	}
 
-	template<int bits, int pbits, bool transparent, const uint8_t table[0x100][1 << 1 * (2 * (bits + 1) - 1)]>
+	template<int bits, int pbits, bool transparent, uint8_t(*LevelTables::*table)[1 << 1 * (2 * (bits + 1) - 1)]>
 	NOTINLINED void ComputeChannelLevelsReduced(const Area& area, const size_t offset, const int weight, const int water) noexcept
 	{
 		const uint8_t* values[16];
 
+		const LevelTables& tables = *gLevelTables;
+
+		const uint8_t* deltas = (tables.*table)[0];
+		const size_t row = tables.RowStep(sizeof((tables.*table)[0]));
+		const size_t tile = tables.TileStep();
+
 		size_t count;
 		if constexpr (transparent)
 		{
@@ -60,11 +70,14 @@ public:
 			count = area.Count;
 		}
 
-		for (size_t i = 0; i < count; i++)
-		{
-			size_t value = ((const uint16_t*)&area.DataMask_I16[i])[offset];
+		size_t unique[16];
+		__m128i weights[16];
+
+		const size_t n = GatherUniqueValues(area, offset, count, unique, weights);
 
-			values[i] = table[value];
+		for (size_t i = 0; i < n; i++)
+		{
+			values[i] = deltas + unique[i] * row;
 		}
 
 		int top = (water + weight - 1) / weight;
@@ -137,7 +150,14 @@ public:
 			{
 				int cH = (iH << shift);
 
-				Estimate16PStep8Short(nodesPtr, values, count, cH, LH + cH, mtop, pL);
+				if (n < count)
+				{
+					Estimate16PStep8Short<true>(nodesPtr, values, weights, n, tile, cH, LH + cH, mtop, pL);
+				}
+				else
+				{
+					Estimate16PStep8Short<false>(nodesPtr, values, weights, n, tile, cH, LH + cH, mtop, pL);
+				}
 			}
 		}
 
@@ -207,7 +227,8 @@ private:
 
 #if defined(OPTION_AVX2)
 
-	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop, const int pL) noexcept
+	template<bool weighted>
+	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop, const int pL) noexcept
 	{
 		const __m256i vtop = _mm256_broadcastw_epi16(mtop);
 
@@ -217,13 +238,15 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c >> 1), tile);
+
 			__m256i vsum = _mm256_setzero_si256();
 
 			for (size_t i = 0; i < count; i++)
 			{
 				auto value = values[i];
 
-				const __m128i* p = (const __m128i*)&value[c >> 1];
+				const __m128i* p = (const __m128i*)&value[at];
 
 				__m128i mdelta = _mm_load_si128(p);
 				mdelta = _mm_and_si128(_mm_srl_epi16(mdelta, mshift), mmask);
@@ -232,6 +255,11 @@ private:
 
 				vadd = _mm256_mullo_epi16(vadd, vadd);
 
+				if constexpr (weighted)
+				{
+					vadd = _mm256_mullo_epi16(vadd, _mm256_broadcastsi128_si256(weights[i]));
+				}
+
 				vsum = _mm256_add_epi16(vsum, vadd);
 			}
 
@@ -256,7 +284,8 @@ private:
 
 #else
 
-	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const size_t count, const int cH, int hL, const __m128i mtop, const int pL) noexcept
+	template<bool weighted>
+	static INLINED void Estimate16PStep8Short(NodeShort*& nodesPtr, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int cH, int hL, const __m128i mtop, const int pL) noexcept
 	{
 		const __m128i mshift = _mm_cvtsi32_si128(pL << 2);
 		const __m128i mmask = _mm_set1_epi8(0xF);
@@ -264,13 +293,15 @@ private:
 		int c = cH;
 		do
 		{
+			const size_t at = LevelTileOffset(static_cast<size_t>(c >> 1), tile);
+
 			__m128i msum = _mm_setzero_si128();
 
 			for (size_t i = 0; i < count; i++)
 			{
 				auto value = values[i];
 
-				const __m128i* p = (const __m128i*)&value[c >> 1];
+				const __m128i* p = (const __m128i*)&value[at];
 
 				__m128i mdelta = _mm_loadl_epi64(p);
 				mdelta = _mm_and_si128(_mm_srl_epi16(mdelta, mshift), mmask);
@@ -279,6 +310,11 @@ private:
 
 				madd = _mm_mullo_epi16(madd, madd);
 
+				if constexpr (weighted)
+				{
+					madd = _mm_mullo_epi16(madd, weights[i]);
+				}
+
 				msum = _mm_add_epi16(msum, madd);
 			}
 
@@ -298,3 +334,5 @@ private:
 
 #endif
 };
+
+CORE_NAMESPACE_END
@@ -2,6 +2,10 @@
 
 #include "pch.h"
 #include "Bc7Core.h"
+#include "Bc7Tables.h"
+#include "SnippetLevelsUnique.h"
+
+CORE_NAMESPACE_BEGIN
 
 #if defined(OPTION_COUNTERS)
 inline std::atomic_int gMinimumFull, gMinimumShort;
@@ -21,15 +25,18 @@ namespace LevelsMinimum {
 
 #if defined(OPTION_AVX512)
 
-	static INLINED void Estimate32Short(__m512i& wbest, const uint8_t* values[16], const size_t count, const int c) noexcept
+	template<bool weighted>
+	static INLINED void Estimate32Short(__m512i& wbest, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int c) noexcept
 	{
+		const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 		__m512i wsum = _mm512_setzero_si512();
 
 		for (size_t i = 0; i < count; i++)
 		{
 			auto value = values[i];
 
-			const __m256i* p = (const __m256i*)&value[c];
+			const __m256i* p = (const __m256i*)&value[at];
 
 			__m256i vdelta = _mm256_load_si256(p);
 
@@ -37,6 +44,11 @@ namespace LevelsMinimum {
 
 			wadd = _mm512_mullo_epi16(wadd, wadd);
 
+			if constexpr (weighted)
+			{
+				wadd = MultiplyWeightSaturated(wadd, weights[i]);
+			}
+
 			wsum = _mm512_adds_epu16(wsum, wadd);
 		}
 
@@ -45,8 +57,11 @@ namespace LevelsMinimum {
 
 #elif defined(OPTION_AVX2)
 
-	static INLINED void Estimate32Short(__m256i& vbest, const uint8_t* values[16], const size_t count, const int c) noexcept
+	template<bool weighted>
+	static INLINED void Estimate32Short(__m256i& vbest, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int c) noexcept
 	{
+		const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 		__m256i vsum0 = _mm256_setzero_si256();
 		__m256i vsum1 = _mm256_setzero_si256();
 
@@ -56,7 +71,7 @@ namespace LevelsMinimum {
 		{
 			auto value = values[i];
 
-			const __m256i* p = (const __m256i*)&value[c];
+			const __m256i* p = (const __m256i*)&value[at];
 
 			__m256i vdelta = _mm256_load_si256(p);
 
@@ -66,6 +81,12 @@ namespace LevelsMinimum {
 			vadd0 = _mm256_mullo_epi16(vadd0, vadd0);
 			vadd1 = _mm256_mullo_epi16(vadd1, vadd1);
 
+			if constexpr (weighted)
+			{
+				vadd0 = MultiplyWeightSaturated(vadd0, weights[i]);
+				vadd1 = MultiplyWeightSaturated(vadd1, weights[i]);
+			}
+
 			vsum0 = _mm256_adds_epu16(vsum0, vadd0);
 			vsum1 = _mm256_adds_epu16(vsum1, vadd1);
 		}
@@ -75,8 +96,11 @@ namespace LevelsMinimum {
 
 #else
 
-	static INLINED void Estimate32Short(__m128i& mbest, const uint8_t* values[16], const size_t count, const int c) noexcept
+	template<bool weighted>
+	static INLINED void Estimate32Short(__m128i& mbest, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int c) noexcept
 	{
+		const size_t at = LevelTileOffset(static_cast<size_t>(c), tile);
+
 		__m128i msum0 = _mm_setzero_si128();
 		__m128i msum1 = _mm_setzero_si128();
 		__m128i msum2 = _mm_setzero_si128();
@@ -88,7 +112,7 @@ namespace LevelsMinimum {
 		{
 			auto value = values[i];
 
-			const __m128i* p = (const __m128i*)&value[c];
+			const __m128i* p = (const __m128i*)&value[at];
 
 			__m128i mdelta0 = _mm_load_si128(&p[0]);
 			__m128i mdelta1 = _mm_load_si128(&p[1]);
@@ -103,6 +127,14 @@ namespace LevelsMinimum {
 			madd2 = _mm_mullo_epi16(madd2, madd2);
 			madd3 = _mm_mullo_epi16(madd3, madd3);
 
+			if constexpr (weighted)
+			{
+				madd0 = MultiplyWeightSaturated(madd0, weights[i]);
+				madd1 = MultiplyWeightSaturated(madd1, weights[i]);
+				madd2 = MultiplyWeightSaturated(madd2, weights[i]);
+				madd3 = MultiplyWeightSaturated(madd3, weights[i]);
+			}
+
 			msum0 = _mm_adds_epu16(msum0, madd0);
 			msum1 = _mm_adds_epu16(msum1, madd1);
 			msum2 = _mm_adds_epu16(msum2, madd2);
@@ -114,35 +146,142 @@ namespace LevelsMinimum {
 
 #endif
 
-	template<int bits, bool transparent, const uint8_t table[0x100][1 << 2 * bits], const uint16_t tower[0x100][1 << bits]>
-	NOTINLINED int EstimateChannelLevelsReduced(const Area& area, const size_t offset, const int weight, const int water) noexcept
+	// 32 packed deltas, sums of squares never exceed 15 * 15 * 16
+#if defined(OPTION_AVX512)
+
+	template<bool weighted>
+	static INLINED void Estimate32Half(__m512i& wbest, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int c) noexcept
 	{
-		const uint8_t* values[16];
-		const uint16_t* cuts[16];
+		const size_t at = LevelTileOffset(static_cast<size_t>(c >> 1), tile);
 
-		size_t count;
-		if constexpr (transparent)
+		__m512i wsum = _mm512_setzero_si512();
+
+		const __m512i wmask = _mm512_set1_epi16(0xF);
+
+		for (size_t i = 0; i < count; i++)
 		{
-			count = area.Active;
+			auto value = values[i];
 
-			if (!count)
+			const __m128i* p = (const __m128i*)&value[at];
+
+			__m256i vdelta = _mm256_cvtepu8_epi16(_mm_load_si128(p));
+
+			__m512i wadd = _mm512_inserti64x4(_mm512_castsi256_si512(vdelta), _mm256_srli_epi16(vdelta, 4), 1);
+			wadd = _mm512_and_si512(wadd, wmask);
+
+			wadd = _mm512_mullo_epi16(wadd, wadd);
+
+			if constexpr (weighted)
 			{
-				return 0;
+				wadd = _mm512_mullo_epi16(wadd, _mm512_broadcast_i32x4(weights[i]));
 			}
+
+			wsum = _mm512_add_epi16(wsum, wadd);
 		}
-		else
+
+		wbest = _mm512_min_epu16(wbest, wsum);
+	}
+
+#elif defined(OPTION_AVX2)
+
+	template<bool weighted>
+	static INLINED void Estimate32Half(__m256i& vbest, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int c) noexcept
+	{
+		const size_t at = LevelTileOffset(static_cast<size_t>(c >> 1), tile);
+
+		__m256i vsum0 = _mm256_setzero_si256();
+		__m256i vsum1 = _mm256_setzero_si256();
+
+		const __m256i vmask = _mm256_set1_epi16(0xF);
+
+		for (size_t i = 0; i < count; i++)
 		{
-			count = area.Count;
+			auto value = values[i];
+
+			const __m128i* p = (const __m128i*)&value[at];
+
+			__m256i vdelta = _mm256_cvtepu8_epi16(_mm_load_si128(p));
+
+			__m256i vadd0 = _mm256_and_si256(vdelta, vmask);
+			__m256i vadd1 = _mm256_srli_epi16(vdelta, 4);
+
+			vadd0 = _mm256_mullo_epi16(vadd0, vadd0);
+			vadd1 = _mm256_mullo_epi16(vadd1, vadd1);
+
+			if constexpr (weighted)
+			{
+				const __m256i vweight = _mm256_broadcastsi128_si256(weights[i]);
+
+				vadd0 = _mm256_mullo_epi16(vadd0, vweight);
+				vadd1 = _mm256_mullo_epi16(vadd1, vweight);
+			}
+
+			vsum0 = _mm256_add_epi16(vsum0, vadd0);
+			vsum1 = _mm256_add_epi16(vsum1, vadd1);
 		}
 
+		vbest = _mm256_min_epu16(vbest, _mm256_min_epu16(vsum0, vsum1));
+	}
+
+#else
+
+	template<bool weighted>
+	static INLINED void Estimate32Half(__m128i& mbest, const uint8_t* values[16], const __m128i weights[16], const size_t count, const size_t tile, const int c) noexcept
+	{
+		const size_t at = LevelTileOffset(static_cast<size_t>(c >> 1), tile);
+
+		__m128i msum0 = _mm_setzero_si128();
+		__m128i msum1 = _mm_setzero_si128();
+		__m128i msum2 = _mm_setzero_si128();
+		__m128i msum3 = _mm_setzero_si128();
+
+		const __m128i mmask = _mm_set1_epi16(0xF);
+		const __m128i mzero = _mm_setzero_si128();
+
 		for (size_t i = 0; i < count; i++)
 		{
-			size_t value = ((const uint16_t*)&area.DataMask_I16[i])[offset];
+			auto value = values[i];
+
+			const __m128i* p = (const __m128i*)&value[at];
+
+			__m128i mdelta = _mm_load_si128(p);
+
+			__m128i mdelta0 = _mm_cvtepu8_epi16(mdelta);
+			__m128i mdelta1 = _mm_unpackhi_epi8(mdelta, mzero);
+
+			__m128i madd0 = _mm_and_si128(mdelta0, mmask);
+			__m128i madd1 = _mm_srli_epi16(mdelta0, 4);
+			__m128i madd2 = _mm_and_si128(mdelta1, mmask);
+			__m128i madd3 = _mm_srli_epi16(mdelta1, 4);
 
-			values[i] = table[value];
-			cuts[i] = tower[value];
+			madd0 = _mm_mullo_epi16(madd0, madd0);
+			madd1 = _mm_mullo_epi16(madd1, madd1);
+			madd2 = _mm_mullo_epi16(madd2, madd2);
+			madd3 = _mm_mullo_epi16(madd3, madd3);
+
+			if constexpr (weighted)
+			{
+				madd0 = _mm_mullo_epi16(madd0, weights[i]);
+				madd1 = _mm_mullo_epi16(madd1, weights[i]);
+				madd2 = _mm_mullo_epi16(madd2, weights[i]);
+				madd3 = _mm_mullo_epi16(madd3, weights[i]);
+			}
+
+			msum0 = _mm_add_epi16(msum0, madd0);
+			msum1 = _mm_add_epi16(msum1, madd1);
+			msum2 = _mm_add_epi16(msum2, madd2);
+			msum3 = _mm_add_epi16(msum3, madd3);
 		}
 
+		mbest = _mm_min_epu16(mbest, _mm_min_epu16(_mm_min_epu16(msum0, msum1), _mm_min_epu16(msum2, msum3)));
+	}
+
+#endif
+
+	// Saturated deltas only lower the estimate, so it stays a bound
+	template<int bits, bool half, bool weighted>
+	static INLINED int EstimateLevels(const Area& area, const size_t offset, const int weight, const int water, const uint8_t* values[16], const __m128i weights[16], const size_t tile, const uint16_t* cuts[16], const size_t count) noexcept
+	{
 		int top = (water + weight - 1) / weight;
 		if (!top)
 			return 0;
@@ -223,6 +362,11 @@ namespace LevelsMinimum {
 
 				__m512i wadd = _mm512_load_epi64(p);
 
+				if constexpr (weighted)
+				{
+					wadd = MultiplyWeightSaturated(wadd, weights[i]);
+				}
+
 				wcut = _mm512_adds_epu16(wcut, wadd);
 			}
 
@@ -241,6 +385,11 @@ namespace LevelsMinimum {
 
 				__m256i vadd = _mm256_load_si256(p);
 
+				if constexpr (weighted)
+				{
+					vadd = MultiplyWeightSaturated(vadd, weights[i]);
+				}
+
 				vcut = _mm256_adds_epu16(vcut, vadd);
 			}
 
@@ -259,6 +408,11 @@ namespace LevelsMinimum {
 
 				__m128i madd = _mm_load_si128(p);
 
+				if constexpr (weighted)
+				{
+					madd = MultiplyWeightSaturated(madd, weights[i]);
+				}
+
 				mcut = _mm_adds_epu16(mcut, madd);
 			}
 
@@ -286,11 +440,32 @@ namespace LevelsMinimum {
 			for (int iL = cH, hL = Min(LH, iH) + cH; iL <= hL; iL += 32)
 			{
 #if defined(OPTION_AVX512)
-				Estimate32Short(wbest, values, count, iL);
+				if constexpr (half)
+				{
+					Estimate32Half<weighted>(wbest, values, weights, count, tile, iL);
+				}
+				else
+				{
+					Estimate32Short<weighted>(wbest, values, weights, count, tile, iL);
+				}
 #elif defined(OPTION_AVX2)
-				Estimate32Short(vbest, values, count, iL);
+				if constexpr (half)
+				{
+					Estimate32Half<weighted>(vbest, values, weights, count, tile, iL);
+				}
+				else
+				{
+					Estimate32Short<weighted>(vbest, values, weights, count, tile, iL);
+				}
 #else
-				Estimate32Short(mbest, values, count, iL);
+				if constexpr (half)
+				{
+					Estimate32Half<weighted>(mbest, values, weights, count, tile, iL);
+				}
+				else
+				{
+					Estimate32Short<weighted>(mbest, values, weights, count, tile, iL);
+				}
 #endif
 			}
 
@@ -307,4 +482,98 @@ namespace LevelsMinimum {
 		return best * weight;
 	}
 
+	template<int bits, bool transparent, uint8_t(*LevelTables::*table)[1 << 2 * bits], uint16_t(*LevelTables::*tower)[1 << bits]>
+	NOTINLINED int EstimateChannelLevelsReduced(const Area& area, const size_t offset, const int weight, const int water) noexcept
+	{
+		const uint8_t* values[16];
+		const uint16_t* cuts[16];
+
+		const LevelTables& tables = *gLevelTables;
+
+		const uint8_t* deltas = (tables.*table)[0];
+		const size_t row = tables.RowStep(sizeof((tables.*table)[0]));
+		const size_t tile = tables.TileStep();
+
+		const auto towers = tables.*tower;
+
+		size_t count;
+		if constexpr (transparent)
+		{
+			count = area.Active;
+
+			if (!count)
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			count = area.Count;
+		}
+
+		size_t unique[16];
+		__m128i weights[16];
+
+		const size_t n = GatherUniqueValues(area, offset, count, unique, weights);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			values[i] = deltas + unique[i] * row;
+			cuts[i] = towers[unique[i]];
+		}
+
+		if (n < count)
+			return EstimateLevels<bits, false, true>(area, offset, weight, water, values, weights, tile, cuts, n);
+
+		return EstimateLevels<bits, false, false>(area, offset, weight, water, values, weights, tile, cuts, n);
+	}
+
+	template<int bits, bool transparent, uint8_t(*LevelTables::*table)[1 << (2 * bits - 1)], uint16_t(*LevelTables::*tower)[1 << bits]>
+	NOTINLINED int EstimateChannelLevelsReducedHalf(const Area& area, const size_t offset, const int weight, const int water) noexcept
+	{
+		const uint8_t* values[16];
+		const uint16_t* cuts[16];
+
+		const LevelTables& tables = *gLevelTables;
+
+		const uint8_t* deltas = (tables.*table)[0];
+		const size_t row = tables.RowStep(sizeof((tables.*table)[0]));
+		const size_t tile = tables.TileStep();
+
+		const auto towers = tables.*tower;
+
+		size_t count;
+		if constexpr (transparent)
+		{
+			count = area.Active;
+
+			if (!count)
+			{
+				return 0;
+			}
+		}
+		else
+		{
+			count = area.Count;
+		}
+
+		size_t unique[16];
+		__m128i weights[16];
+
+		const size_t n = GatherUniqueValues(area, offset, count, unique, weights);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			values[i] = deltas + unique[i] * row;
+			cuts[i] = towers[unique[i]];
+		}
+
+		if (n < count)
+			return EstimateLevels<bits, true, true>(area, offset, weight, water, values, weights, tile, cuts, n);
+
+		return EstimateLevels<bits, true, false>(area, offset, weight, water, values, weights, tile, cuts, n);
+	}
+
 } // namespace LevelsMinimum
+
+CORE_NAMESPACE_END
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "pch.h"
+#include "Bc7Core.h"
+
+CORE_NAMESPACE_BEGIN
+
+// Repeated channel values share one table row, weights hold the multiplicities broadcast to 16-bit lanes
+static ALWAYS_INLINED size_t GatherUniqueValues(const Area& area, const size_t offset, const size_t count, size_t unique[16], __m128i weights[16]) noexcept
+{
+	uint64_t seen[4] = {};
+	uint8_t slots[0x100];
+	int counts[16];
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t value = ((const uint16_t*)&area.DataMask_I16[i])[offset];
+
+		const uint64_t bit = 1uLL << (value & 63);
+		if (seen[value >> 6] & bit)
+		{
+			counts[slots[value]]++;
+		}
+		else
+		{
+			seen[value >> 6] |= bit;
+
+			slots[value] = static_cast<uint8_t>(n);
+			counts[n] = 1;
+			unique[n++] = value;
+		}
+	}
+
+	if (n < count)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			weights[i] = _mm_set1_epi16(static_cast<short>(counts[i]));
+		}
+	}
+
+	return n;
+}
+
+// Squares reach 18 bits once weighted, the sums saturate as the unweighted ones do
+#if defined(OPTION_AVX512)
+
+inline ALWAYS_INLINED __m512i MultiplyWeightSaturated(__m512i wsquare, const __m128i& weight) noexcept
+{
+	const __m512i wweight = _mm512_broadcast_i32x4(weight);
+
+	__m512i wlow = _mm512_mullo_epi16(wsquare, wweight);
+	__mmask32 high = _mm512_test_epi16_mask(_mm512_mulhi_epu16(wsquare, wweight), _mm512_set1_epi16(-1));
+
+	return _mm512_mask_mov_epi16(wlow, high, _mm512_set1_epi16(-1));
+}
+
+#endif
+
+#if defined(OPTION_AVX2)
+
+inline ALWAYS_INLINED __m256i MultiplyWeightSaturated(__m256i vsquare, const __m128i& weight) noexcept
+{
+	const __m256i vweight = _mm256_broadcastsi128_si256(weight);
+
+	__m256i vlow = _mm256_mullo_epi16(vsquare, vweight);
+	__m256i vhigh = _mm256_mulhi_epu16(vsquare, vweight);
+
+	return _mm256_or_si256(vlow, _mm256_cmpgt_epi16(vhigh, _mm256_setzero_si256()));
+}
+
+#endif
+
+inline ALWAYS_INLINED __m128i MultiplyWeightSaturated(__m128i msquare, const __m128i& weight) noexcept
+{
+	__m128i mlow = _mm_mullo_epi16(msquare, weight);
+	__m128i mhigh = _mm_mulhi_epu16(msquare, weight);
+
+	return _mm_or_si128(mlow, _mm_cmpgt_epi16(mhigh, _mm_setzero_si128()));
+}
+
+CORE_NAMESPACE_END
@@ -1,16 +1,21 @@
 
 #include "pch.h"
 #include "Worker.h"
-#include "Metrics.h"
+#include "Numa.h"
 
 #if defined(WIN32)
 #include <windows.h>
 #endif
 
+#include <algorithm>
 #include <stdexcept>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <vector>
 
 #if !defined(OPTION_LIBRARY)
 
@@ -21,37 +26,99 @@ static ALWAYS_INLINED int Max(int x, int y) noexcept
 
 #endif
 
-class WorkerJob
+constexpr size_t kWorkerBatch = 0x40;
+constexpr size_t kWorkerBatchMaximal = 0x400;
+constexpr size_t kWorkerBatchesPerThread = 16;
+
+// In pixels, 16x16 blocks
+constexpr int kWorkerTile = 64;
+
+struct WorkerBatch
 {
-public:
-	WorkerJob* _Next;
+	size_t Begin, End;
+	uint64_t Cost;
+
+	WorkerBatch(size_t begin, size_t end, uint64_t cost) noexcept
+		: Begin(begin)
+		, End(end)
+		, Cost(cost)
+	{
+	}
+};
 
+// Chase-Lev deque over a fixed span of batch indices, filled before each run.
+// The owner pops batches in ascending order from the bottom, thieves take the far end from the top.
+class alignas(64) WorkerDeque
+{
 protected:
-	int _Count;
-	WorkerItem _Items[0x100];
+	std::atomic<int64_t> _Top;
+	std::atomic<int64_t> _Bottom;
+
+	int64_t _Last;
 
 public:
-	WorkerJob()
-		: _Next(nullptr)
-		, _Count(0)
+	enum class Result { Empty, Abort, Success };
+
+	WorkerDeque()
+		: _Top(0)
+		, _Bottom(0)
+		, _Last(0)
 	{
 	}
 
-	bool Add(const WorkerItem& item)
+	// Not concurrent
+	void Reset(size_t first, size_t last)
 	{
-		_Items[_Count++] = item;
+		_Last = (int64_t)last - 1;
 
-		return _Count >= (int)(sizeof(_Items) / sizeof(_Items[0]));
+		_Top.store(0, std::memory_order_relaxed);
+		_Bottom.store((int64_t)(last - first), std::memory_order_relaxed);
 	}
 
-	WorkerItem* begin()
+	// Owner only
+	bool Pop(size_t& batch)
 	{
-		return _Items;
+		int64_t b = _Bottom.load(std::memory_order_relaxed) - 1;
+		_Bottom.store(b, std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		int64_t t = _Top.load(std::memory_order_relaxed);
+		if (t > b)
+		{
+			_Bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		batch = (size_t)(_Last - b);
+
+		if (t == b)
+		{
+			bool won = _Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+
+			_Bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+
+		return true;
 	}
 
-	WorkerItem* end()
+	Result Steal(size_t& batch)
 	{
-		return _Items + _Count;
+		int64_t t = _Top.load(std::memory_order_acquire);
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		int64_t b = _Bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return Result::Empty;
+
+		batch = (size_t)(_Last - t);
+
+		if (!_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return Result::Abort;
+
+		return Result::Success;
 	}
 };
 
@@ -60,22 +127,36 @@ class Worker
 protected:
 #if defined(WIN32)
 	CRITICAL_SECTION _Sync;
-	HANDLE _Done;
+	CONDITION_VARIABLE _Wake;
+	CONDITION_VARIABLE _Done;
 #else
 	std::mutex _Sync;
+	std::condition_variable _Wake;
+	std::condition_variable _Done;
 #endif
 
+	std::vector<std::thread> _Threads;
+
 	PBlockKernel _BlockKernel;
+	PBlockCost _BlockCost;
+	PRangeKernel _RangeKernel;
+	void* _RangeContext;
 	int _Stride;
 
-	WorkerJob* _First;
-	WorkerJob* _Last;
+	std::vector<WorkerItem> _Items;
+	std::vector<uint32_t> _Costs;
+	std::vector<WorkerBatch> _Batches;
+	std::vector<WorkerBatch> _Sorted;
+	std::unique_ptr<WorkerDeque[]> _Deques;
+	int _DequeCount;
 
 	int64_t _errorAlpha;
 	int64_t _errorColor;
 	BlockSSIM _ssim;
 
-	std::atomic_int _Running;
+	int _Generation;
+	int _Running;
+	bool _Exit;
 
 public:
 	Worker()
@@ -87,35 +168,50 @@ public:
 		if (!InitializeCriticalSectionAndSpinCount(&_Sync, 1000))
 			throw std::runtime_error("init");
 
-		_Done = CreateEvent(NULL, FALSE, FALSE, NULL);
-		if (_Done == nullptr)
-			throw std::runtime_error("init");
+		InitializeConditionVariable(&_Wake);
+		InitializeConditionVariable(&_Done);
 #endif
 
 		_BlockKernel = nullptr;
+		_BlockCost = nullptr;
+		_RangeKernel = nullptr;
+		_RangeContext = nullptr;
 		_Stride = 0;
 
-		_First = nullptr;
-		_Last = nullptr;
-
+		_Generation = 0;
 		_Running = 0;
+		_Exit = false;
+
+		// The calling thread works too and owns deque 0
+		int n = Max(1, (int)std::thread::hardware_concurrency());
+
+		_Deques.reset(new WorkerDeque[n]);
+		_DequeCount = n;
+
+		_Threads.reserve(n - 1);
+
+		for (int i = 1; i < n; i++)
+		{
+			_Threads.emplace_back(std::bind(ThreadProc, this, i));
+		}
 	}
 
 	~Worker()
 	{
-		for (WorkerJob* job; (job = _First) != nullptr;)
-		{
-			_First = job->_Next;
+		Lock();
 
-			delete job;
-		}
+		_Exit = true;
 
-		_Last = nullptr;
+		WakeAll();
 
-#if defined(WIN32)
-		if (_Done != nullptr)
-			CloseHandle(_Done), _Done = nullptr;
+		UnLock();
 
+		for (auto& thread : _Threads)
+		{
+			thread.join();
+		}
+
+#if defined(WIN32)
 		DeleteCriticalSection(&_Sync);
 #endif
 	}
@@ -138,302 +234,372 @@ public:
 #endif
 	}
 
-	void Add(WorkerJob* job)
+	// Keeps capacity between calls, so steady state allocates nothing
+	std::vector<WorkerItem>& Items()
 	{
-		if (_Last)
-			_Last->_Next = job;
-		else
-			_First = job;
-
-		_Last = job;
+		return _Items;
 	}
 
 protected:
-	WorkerJob* Take()
+	// Must be called under Lock
+	void WaitWake()
 	{
-		Lock();
-
-		WorkerJob* job = _First;
-		if (job)
-		{
-			_First = job->_Next;
+#if defined(WIN32)
+		SleepConditionVariableCS(&_Wake, &_Sync, INFINITE);
+#else
+		std::unique_lock<std::mutex> lock(_Sync, std::adopt_lock);
+		_Wake.wait(lock);
+		lock.release();
+#endif
+	}
 
-			if (_First == nullptr)
-				_Last = nullptr;
-		}
+	void WakeAll()
+	{
+#if defined(WIN32)
+		WakeAllConditionVariable(&_Wake);
+#else
+		_Wake.notify_all();
+#endif
+	}
 
-		UnLock();
+	// Must be called under Lock
+	void WaitDone()
+	{
+#if defined(WIN32)
+		SleepConditionVariableCS(&_Done, &_Sync, INFINITE);
+#else
+		std::unique_lock<std::mutex> lock(_Sync, std::adopt_lock);
+		_Done.wait(lock);
+		lock.release();
+#endif
+	}
 
-		return job;
+	void SignalDone()
+	{
+#if defined(WIN32)
+		WakeConditionVariable(&_Done);
+#else
+		_Done.notify_one();
+#endif
 	}
 
-	static void ThreadProc(Worker* worker)
+	bool Steal(int index, size_t& batch)
 	{
-		int64_t errorAlpha = 0;
-		int64_t errorColor = 0;
-		BlockSSIM ssim = BlockSSIM(0, 0);
+		const int n = _DequeCount;
 
-		for (WorkerJob* job; (job = worker->Take()) != nullptr;)
+		for (;;)
 		{
-			worker->_BlockKernel(job->begin(), job->end(), worker->_Stride, errorAlpha, errorColor, ssim);
-
-			delete job;
-		}
+			bool empty = true;
 
-		worker->Lock();
-
-		worker->_errorAlpha += errorAlpha;
-		worker->_errorColor += errorColor;
+			for (int i = 1; i < n; i++)
+			{
+				int victim = index + i;
+				if (victim >= n)
+					victim -= n;
 
-		worker->_ssim.Alpha += ssim.Alpha;
-		worker->_ssim.Color += ssim.Color;
+				WorkerDeque::Result result = _Deques[victim].Steal(batch);
+				if (result == WorkerDeque::Result::Success)
+					return true;
 
-		worker->UnLock();
+				if (result == WorkerDeque::Result::Abort)
+					empty = false;
+			}
 
-		worker->_Running--;
+			// Nothing is pushed during a run, so all empty means done
+			if (empty)
+				return false;
 
-#if defined(WIN32)
-		if (worker->_Running <= 0)
-		{
-			SetEvent(worker->_Done);
+			std::this_thread::yield();
 		}
-#endif
 	}
 
-public:
-	void Run(PBlockKernel blockKernel, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim)
+	void Process(int index)
 	{
-		_BlockKernel = blockKernel;
-		_Stride = stride;
-
-		_errorAlpha = 0;
-		_errorColor = 0;
-		_ssim = BlockSSIM(0, 0);
+		int64_t errorAlpha = 0;
+		int64_t errorColor = 0;
+		BlockSSIM ssim = BlockSSIM(0, 0);
 
-		int n = Max(1, (int)std::thread::hardware_concurrency());
-		_Running = n;
+		const WorkerItem* items = _Items.data();
+		const WorkerBatch* batches = _Batches.data();
 
-		for (int i = 0; i < n; i++)
-		{
-			std::thread thread(std::bind(ThreadProc, this));
-			thread.detach();
-		}
+		WorkerDeque& own = _Deques[index];
 
-#if defined(WIN32)
-		WaitForSingleObject(_Done, INFINITE);
-#else
-		for (;; )
+		for (size_t batch;;)
 		{
-			std::this_thread::yield();
-
-			if (_Running <= 0)
+			if (!own.Pop(batch) && !Steal(index, batch))
 				break;
-		}
-#endif
 
-		pErrorAlpha = _errorAlpha;
-		pErrorColor = _errorColor;
-		pssim = _ssim;
-	}
-};
+			const WorkerBatch& b = batches[batch];
 
-void ProcessTexture(uint8_t* dst, uint8_t* src_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h, PBlockKernel blockKernel, size_t block_size, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim)
-{
-	Worker worker;
+			if (_RangeKernel)
+			{
+				_RangeKernel(_RangeContext, b.Begin, b.End);
+			}
+			else if (_BlockCost)
+			{
+				_BlockCost(items + b.Begin, items + b.End, _Stride, _Costs.data() + b.Begin);
+			}
+			else
+			{
+				_BlockKernel(items + b.Begin, items + b.End, _Stride, errorAlpha, errorColor, ssim);
+			}
+		}
 
-	WorkerJob* job = new WorkerJob();
+		Lock();
 
-	uint8_t* output = dst;
+		_errorAlpha += errorAlpha;
+		_errorColor += errorColor;
 
-	for (int y = 0; y < src_h; y += 4)
-	{
-		uint8_t* cell = src_bgra + y * stride;
-		uint8_t* mask = mask_agrb + y * stride;
+		_ssim.Alpha += ssim.Alpha;
+		_ssim.Color += ssim.Color;
 
-		for (int x = 0; x < src_w; x += 4)
+		if (--_Running <= 0)
 		{
-			if (job->Add(WorkerItem(output, cell, mask)))
-			{
-				worker.Add(job);
-
-				job = new WorkerJob();
-			}
-
-			output += block_size;
-			cell += 16;
-			mask += 16;
+			SignalDone();
 		}
-	}
 
-	worker.Add(job);
+		UnLock();
+	}
 
-	worker.Run(blockKernel, stride, pErrorAlpha, pErrorColor, pssim);
-}
+	static void ThreadProc(Worker* worker, int index)
+	{
+		// Spread over nodes, the core picks node-local tables
+		const int nodes = NumaNodeCount();
+		if (nodes > 1)
+		{
+			NumaPinThread(index % nodes);
+		}
 
-static ALWAYS_INLINED __m128i ConvertBgraToAgrb(__m128i mc) noexcept
-{
-	const __m128i mrot = _mm_set_epi8(
-		0 + 12, 2 + 12, 1 + 12, 3 + 12,
-		0 + 8, 2 + 8, 1 + 8, 3 + 8,
-		0 + 4, 2 + 4, 1 + 4, 3 + 4,
-		0, 2, 1, 3);
+		int generation = 0;
 
-	return _mm_shuffle_epi8(mc, mrot);
-}
+		worker->Lock();
 
-bool DetectGlitches(const Cell& input, const Cell& output) noexcept
-{
-	const __m128i msign = _mm_set1_epi8(-0x80);
+		for (;;)
+		{
+			while (!worker->_Exit && (worker->_Generation == generation))
+			{
+				worker->WaitWake();
+			}
 
-#if defined(OPTION_LINEAR)
+			if (worker->_Exit)
+				break;
 
-	const __m128i mstep = _mm_set1_epi8(16 - 129);
+			generation = worker->_Generation;
 
-#else
+			worker->UnLock();
 
-	const __m128i mstep = _mm_set_epi8(
-		20 - 129, 16 - 129, 12 - 129, 16 - 129,
-		20 - 129, 16 - 129, 12 - 129, 16 - 129,
-		20 - 129, 16 - 129, 12 - 129, 16 - 129,
-		20 - 129, 16 - 129, 12 - 129, 16 - 129);
+			worker->Process(index);
 
-#endif
+			worker->Lock();
+		}
 
-	__m128i me = _mm_setzero_si128();
+		worker->UnLock();
+	}
 
-	for (int y = 0; y < 4; y++)
+	void SplitUniform(size_t count, size_t step)
 	{
-		__m128i mc1 = input.ImageRows_U8[y];
-		__m128i mc2 = output.ImageRows_U8[y];
+		_Batches.clear();
 
-		__m128i mmask = input.MaskRows_S8[y];
+		for (size_t begin = 0; begin < count; begin += step)
+		{
+			size_t end = (count - begin > step) ? begin + step : count;
 
-		__m128i md = _mm_or_si128(_mm_subs_epu8(mc1, mc2), _mm_subs_epu8(mc2, mc1));
-		md = _mm_and_si128(md, mmask);
+			_Batches.emplace_back(begin, end, 0);
+		}
 
-		md = _mm_xor_si128(md, msign);
-		md = _mm_cmpgt_epi8(md, mstep);
+		// Contiguous spans keep each thread on neighbouring rows until it has to steal
+		const size_t batches = _Batches.size();
+		const size_t n = (size_t)_DequeCount;
 
-		me = _mm_or_si128(me, md);
+		for (size_t i = 0; i < n; i++)
+		{
+			_Deques[i].Reset(batches * i / n, batches * (i + 1) / n);
+		}
 	}
 
-	return _mm_movemask_epi8(me) != 0;
-}
+	// Batches of equal predicted work, dealt longest first
+	void SplitByCost()
+	{
+		const size_t count = _Items.size();
+		const uint32_t* costs = _Costs.data();
 
-void ShowBadBlocks(const uint8_t* src_bgra, const uint8_t* dst_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h) noexcept
-{
-	Cell input;
-	Cell output;
+		uint64_t total = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			total += costs[i];
+		}
 
-	for (int y = 0; y < src_h; y += 4)
-	{
-		const uint8_t* src = src_bgra + y * stride;
-		const uint8_t* dst = dst_bgra + y * stride;
-		uint8_t* mask = mask_agrb + y * stride;
+		const size_t n = (size_t)_DequeCount;
 
-		for (int x = 0; x < src_w; x += 4)
+		uint64_t target = total / (n * kWorkerBatchesPerThread);
+		if (target < 1)
+			target = 1;
+
+		_Sorted.clear();
+
+		for (size_t begin = 0; begin < count;)
 		{
+			uint64_t cost = 0;
+
+			size_t end = begin;
+			do
 			{
-				const uint8_t* p = src;
+				cost += costs[end++];
+			} while ((end < count) && (cost < target) && (end - begin < kWorkerBatchMaximal));
 
-				input.ImageRows_U8[0] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			_Sorted.emplace_back(begin, end, cost);
 
-				p += stride;
+			begin = end;
+		}
 
-				input.ImageRows_U8[1] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+		std::stable_sort(_Sorted.begin(), _Sorted.end(), [](const WorkerBatch& x, const WorkerBatch& y)
+		{
+			return x.Cost > y.Cost;
+		});
 
-				p += stride;
+		// Deque i gets sorted batches i, i + n, i + 2n... so every owner starts from its most expensive one
+		const size_t batches = _Sorted.size();
 
-				input.ImageRows_U8[2] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+		_Batches.clear();
 
-				p += stride;
+		for (size_t i = 0; i < n; i++)
+		{
+			size_t first = _Batches.size();
 
-				input.ImageRows_U8[3] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			for (size_t j = i; j < batches; j += n)
+			{
+				_Batches.push_back(_Sorted[j]);
 			}
 
-			{
-				const uint8_t* p = mask;
+			_Deques[i].Reset(first, _Batches.size());
+		}
+	}
 
-				input.MaskRows_S8[0] = _mm_loadu_si128((const __m128i*)p);
+	void Dispatch()
+	{
+		Lock();
 
-				p += stride;
+		_Running = (int)_Threads.size() + 1;
+		_Generation++;
 
-				input.MaskRows_S8[1] = _mm_loadu_si128((const __m128i*)p);
+		WakeAll();
 
-				p += stride;
+		UnLock();
 
-				input.MaskRows_S8[2] = _mm_loadu_si128((const __m128i*)p);
+		Process(0);
 
-				p += stride;
+		Lock();
 
-				input.MaskRows_S8[3] = _mm_loadu_si128((const __m128i*)p);
-			}
+		while (_Running > 0)
+		{
+			WaitDone();
+		}
 
-			{
-				const uint8_t* p = dst;
+		UnLock();
+	}
 
-				output.ImageRows_U8[0] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+public:
+	void Run(PBlockKernel blockKernel, PBlockCost blockCost, int stride, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim)
+	{
+		_BlockKernel = blockKernel;
+		_Stride = stride;
 
-				p += stride;
+		_errorAlpha = 0;
+		_errorColor = 0;
+		_ssim = BlockSSIM(0, 0);
 
-				output.ImageRows_U8[1] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+		SplitUniform(_Items.size(), kWorkerBatch);
 
-				p += stride;
+		if (blockCost)
+		{
+			_Costs.resize(_Items.size());
 
-				output.ImageRows_U8[2] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
+			_BlockCost = blockCost;
 
-				p += stride;
+			Dispatch();
 
-				output.ImageRows_U8[3] = ConvertBgraToAgrb(_mm_loadu_si128((const __m128i*)p));
-			}
+			_BlockCost = nullptr;
 
-			bool bad = DetectGlitches(input, output);
-			if (bad)
-			{
-				const uint8_t* r = src;
-				uint8_t* p = mask;
+			SplitByCost();
+		}
 
-				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+		Dispatch();
 
-				r += stride;
-				p += stride;
+		pErrorAlpha = _errorAlpha;
+		pErrorColor = _errorColor;
+		pssim = _ssim;
+	}
 
-				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+	void RunRange(size_t count, size_t step, PRangeKernel rangeKernel, void* context)
+	{
+		_RangeKernel = rangeKernel;
+		_RangeContext = context;
 
-				r += stride;
-				p += stride;
+		SplitUniform(count, step);
 
-				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
+		Dispatch();
 
-				r += stride;
-				p += stride;
+		_RangeKernel = nullptr;
+		_RangeContext = nullptr;
+	}
+};
 
-				_mm_storeu_si128((__m128i*)p, _mm_loadu_si128((const __m128i*)r));
-			}
-			else
-			{
-				__m128i mc = _mm_setzero_si128();
+// Threads start on first use and sleep between calls
+static Worker& GetWorker()
+{
+	static Worker worker;
 
-				uint8_t* p = mask;
+	return worker;
+}
 
-				_mm_storeu_si128((__m128i*)p, mc);
+static std::mutex gWorkerExclusive;
 
-				p += stride;
+void ProcessTexture(uint8_t* dst, uint8_t* src_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h, PBlockKernel blockKernel, PBlockCost blockCost, size_t block_size, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim)
+{
+	std::lock_guard<std::mutex> lock(gWorkerExclusive);
 
-				_mm_storeu_si128((__m128i*)p, mc);
+	Worker& worker = GetWorker();
 
-				p += stride;
+	std::vector<WorkerItem>& items = worker.Items();
 
-				_mm_storeu_si128((__m128i*)p, mc);
+	items.clear();
+	items.reserve((size_t)((src_h + 3) >> 2) * (size_t)((src_w + 3) >> 2));
 
-				p += stride;
+	const size_t row_size = (size_t)((src_w + 3) >> 2) * block_size;
 
-				_mm_storeu_si128((__m128i*)p, mc);
-			}
+	// Square tiles keep source, mask and output of a batch within L2
+	for (int ty = 0; ty < src_h; ty += kWorkerTile)
+	{
+		const int ty_end = (src_h - ty > kWorkerTile) ? ty + kWorkerTile : src_h;
 
-			src += 16;
-			dst += 16;
-			mask += 16;
+		for (int tx = 0; tx < src_w; tx += kWorkerTile)
+		{
+			const int tx_end = (src_w - tx > kWorkerTile) ? tx + kWorkerTile : src_w;
+
+			for (int y = ty; y < ty_end; y += 4)
+			{
+				uint8_t* output = dst + (size_t)(y >> 2) * row_size + (size_t)(tx >> 2) * block_size;
+				uint8_t* cell = src_bgra + y * stride + tx * 4;
+				uint8_t* mask = mask_agrb + y * stride + tx * 4;
+
+				for (int x = tx; x < tx_end; x += 4)
+				{
+					items.emplace_back(output, cell, mask);
+
+					output += block_size;
+					cell += 16;
+					mask += 16;
+				}
+			}
 		}
 	}
+
+	worker.Run(blockKernel, blockCost, stride, pErrorAlpha, pErrorColor, pssim);
+}
+
+void ProcessRange(size_t count, size_t step, PRangeKernel rangeKernel, void* context)
+{
+	std::lock_guard<std::mutex> lock(gWorkerExclusive);
+
+	GetWorker().RunRange(count, step, rangeKernel, context);
 }
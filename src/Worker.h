@@ -3,8 +3,9 @@
 #include "pch.h"
 #include "Bc7Core.h"
 
-void ProcessTexture(uint8_t* dst, uint8_t* src_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h, PBlockKernel blockKernel, size_t block_size, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim);
+void ProcessTexture(uint8_t* dst, uint8_t* src_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h, PBlockKernel blockKernel, PBlockCost blockCost, size_t block_size, int64_t& pErrorAlpha, int64_t& pErrorColor, BlockSSIM& pssim);
 
-bool DetectGlitches(const Cell& input, const Cell& output) noexcept;
+// Runs [0, count) in slices of step on the shared pool, the calling thread included
+using PRangeKernel = void(*)(void* context, size_t begin, size_t end) noexcept;
 
-void ShowBadBlocks(const uint8_t* src_bgra, const uint8_t* dst_bgra, uint8_t* mask_agrb, int stride, int src_w, int src_h) noexcept;
+void ProcessRange(size_t count, size_t step, PRangeKernel rangeKernel, void* context);
@@ -45,3 +45,12 @@
 #if defined(OPTION_SLOWPOKE)
 #include "SnippetTargetSSSE3.h"
 #endif
+
+// Everything of the core but IBc7Core and its arguments, see Bc7Mode.h
+#if defined(OPTION_CORE_NAMESPACE)
+#define CORE_NAMESPACE_BEGIN namespace OPTION_CORE_NAMESPACE {
+#define CORE_NAMESPACE_END }
+#else
+#define CORE_NAMESPACE_BEGIN
+#define CORE_NAMESPACE_END
+#endif